@@ -0,0 +1,46 @@
+#include "mpi.h"
+#include "../trace/memnesia-api.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIGB 16 * 1024 * 1024
+
+int
+main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+
+    int myid, numprocs;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+
+    MPI_Pcontrol(2, "assembly");
+
+    char *assembly = malloc(BIGB);
+    memset(assembly, 1, BIGB);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if (memnesia_sample_now) memnesia_sample_now("assembled");
+
+    MPI_Pcontrol(2, "solve");
+
+    for (int i = 0; i < 16; ++i) {
+        double in = myid, out = 0.0;
+        MPI_Allreduce(&in, &out, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    }
+    // Not instrumented.
+    MPI_Pcontrol(0);
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Pcontrol(1);
+
+    if (memnesia_mark) memnesia_mark("teardown");
+
+    free(assembly);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    MPI_Finalize();
+    //
+    return 0;
+}
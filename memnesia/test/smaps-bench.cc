@@ -1,76 +1,465 @@
 /*
- * Copyright (c) 2017-2019 Triad National Security, LLC
+ * Copyright (c) 2017-2021 Triad National Security, LLC
  *                         All rights reserved.
  *
  * This file is part of the mpimemu project. See the LICENSE file at the
  * top-level directory of this distribution.
  */
 
-#include <cstdlib>
+/**
+ * Times memnesia's sampler backends and /proc parsers against address spaces
+ * of increasing size. For each requested count, that many synthetic VMAs are
+ * created (single pages with alternating protections, so that the kernel
+ * cannot merge them), and every variant is run a number of times. Results are
+ * reported as min, median, and p99 in microseconds, as a table or as CSV.
+ *
+ * Two checks make it usable as a test:
+ * - Parsers of a /proc file must stay within a factor (-r) of merely reading
+ *   that file, which holds across machines.
+ * - Given a CSV from an earlier run (-b), minimums, the least noisy of the
+ *   three, must stay within a tolerance (-t percent, and -a microseconds so
+ *   that jitter in the cheapest variants does not count) of it.
+ * The exit status is 1 if either check fails.
+ */
+
+#include "memnesia-sampler.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
-#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
 #include <vector>
 
-#include <limits.h>
+using namespace std;
+
+namespace {
+//
+struct variant {
+    //
+    const char *name;
+    // The raw read this variant's cost is compared with, if any.
+    const char *reference;
+    // Returns false if the source is not available.
+    bool (*run)(void);
+};
+
+//
+struct result {
+    //
+    string name;
+    //
+    size_t vmas = 0;
+    //
+    int trials = 0;
+    //
+    double min_us = 0.0;
+    //
+    double median_us = 0.0;
+    //
+    double p99_us = 0.0;
+};
+
+/**
+ * Reads a /proc file to the end and throws the bytes away: the least any
+ * parser of it can cost.
+ */
+bool
+raw_read(const char *f_name)
+{
+    static char buff[1 << 16];
+    const int fd = open(f_name, O_RDONLY);
+    if (-1 == fd) return false;
+    ssize_t nr = 0;
+    while ((nr = read(fd, buff, sizeof(buff))) > 0) { }
+    (void)close(fd);
+    return 0 == nr;
+}
+
+//
+template <memnesia_smaps_sampler::backend_id B>
+bool
+run_backend(void)
+{
+    memnesia_smaps_sampler::sample s;
+    return memnesia_sampler_backend<B>::sample(s);
+}
+
+const variant variants[] = {
+    {
+        "read:smaps", nullptr,
+        [] { return raw_read("/proc/self/smaps"); }
+    },
+    {
+        "read:smaps_rollup", nullptr,
+        [] { return raw_read("/proc/self/smaps_rollup"); }
+    },
+    {
+        "read:numa_maps", nullptr,
+        [] { return raw_read("/proc/self/numa_maps"); }
+    },
+    {
+        "backend:smaps", "read:smaps",
+        run_backend<memnesia_smaps_sampler::SMAPS>
+    },
+    {
+        "backend:smaps_rollup", "read:smaps_rollup",
+        run_backend<memnesia_smaps_sampler::SMAPS_ROLLUP>
+    },
+    {
+        "backend:statm", nullptr,
+        run_backend<memnesia_smaps_sampler::STATM>
+    },
+    {
+        "backend:status", nullptr,
+        run_backend<memnesia_smaps_sampler::STATUS>
+    },
+    {
+        "backend:mallinfo2", nullptr,
+        run_backend<memnesia_smaps_sampler::MALLINFO2>
+    },
+    {
+        "parser:statm_rss", nullptr,
+        [] {
+            int64_t rss = 0;
+            return memnesia_statm_sampler::get_rss_in_kb(rss);
+        }
+    },
+    {
+        "parser:mappings", "read:smaps",
+        [] {
+            memnesia_vector<memnesia_mappings_sampler::mapping> m;
+            return memnesia_mappings_sampler::get_mappings(m);
+        }
+    },
+    {
+        "parser:footprint", "read:smaps",
+        [] {
+            memnesia_footprint_sampler::footprint fp;
+            return memnesia_footprint_sampler::get_footprint(fp);
+        }
+    },
+    {
+        "parser:numa", "read:numa_maps",
+        [] {
+            memnesia_numa_sampler::usage u;
+            return memnesia_numa_sampler::available() &&
+                   memnesia_numa_sampler::get_usage(u);
+        }
+    }
+};
+
+//
+size_t
+count_vmas(void)
+{
+    ifstream maps("/proc/self/maps");
+    size_t n = 0;
+    string line;
+    while (getline(maps, line)) ++n;
+    return n;
+}
+
+//
+size_t
+max_map_count(void)
+{
+    ifstream f("/proc/sys/vm/max_map_count");
+    size_t n = 65530;
+    f >> n;
+    return n;
+}
+
+/**
+ * Single-page VMAs in one reserved range. Neighbors differ in protection, so
+ * each page is its own VMA. Readable pages are touched so that they are
+ * resident (writable ones privately so).
+ */
+class synthetic_vmas {
+    //
+    char *base = nullptr;
+    //
+    size_t len = 0;
+    //
+    size_t count = 0;
 
-#include "mpi.h"
+public:
+    //
+    ~synthetic_vmas(void)
+    {
+        clear();
+    }
+    // Returns the number of VMAs made, which vm.max_map_count limits.
+    size_t
+    create(size_t n)
+    {
+        // Headroom for the samplers' (and libc's) own mappings.
+        static const size_t spare = 1024;
+        static const int prots[] = {
+            PROT_READ, PROT_READ | PROT_WRITE, PROT_NONE
+        };
+        const size_t ps = size_t(sysconf(_SC_PAGESIZE));
 
-#define MPICHK(rc) \
-do { \
-    assert(rc == MPI_SUCCESS); \
-} while(0)
+        clear();
+        const size_t in_use = count_vmas();
+        const size_t limit = max_map_count();
+        if (limit < in_use + spare) return 0;
+        n = min(n, limit - in_use - spare);
+        len = n * ps;
+        void *p = mmap(
+            nullptr, len, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+        );
+        if (MAP_FAILED == p) {
+            perror("mmap");
+            exit(EXIT_FAILURE);
+        }
+        base = static_cast<char *>(p);
+
+        for (count = 0; count < n; ++count) {
+            char *page = base + count * ps;
+            const int prot = prots[count % 3];
+            if (PROT_NONE == prot) continue;
+            if (0 != mprotect(page, ps, prot)) {
+                perror("mprotect");
+                break;
+            }
+            if (prot & PROT_WRITE) page[0] = 1;
+            else (void)*static_cast<volatile char *>(page);
+        }
+        return count;
+    }
+    //
+    void
+    clear(void)
+    {
+        if (base) (void)munmap(base, len);
+        base = nullptr;
+        len = count = 0;
+    }
+};
+
+/**
+ * Returns false if the variant is unavailable.
+ */
+bool
+measure(
+    const variant &v,
+    int trials,
+    result &res
+) {
+    using namespace std::chrono;
+    // Also warms up the caches.
+    if (!v.run()) return false;
+
+    vector<double> us(size_t(trials), 0.0);
+    for (auto &t : us) {
+        const auto start = steady_clock::now();
+        (void)v.run();
+        t = duration<double, micro>(steady_clock::now() - start).count();
+    }
+    sort(us.begin(), us.end());
+    res.name = v.name;
+    res.trials = trials;
+    res.min_us = us.front();
+    res.median_us = us[us.size() / 2];
+    const size_t p99 = size_t(ceil(0.99 * double(us.size())));
+    res.p99_us = us[min(us.size(), max(p99, size_t(1))) - 1];
+    return true;
+}
+
+//
+vector<size_t>
+parse_counts(const char *list)
+{
+    vector<size_t> counts;
+    stringstream ss(list);
+    string tok;
+    while (getline(ss, tok, ',')) {
+        if (tok.empty()) continue;
+        counts.push_back(size_t(strtoull(tok.c_str(), nullptr, 10)));
+    }
+    return counts;
+}
+
+/**
+ * Reads minimums from a CSV written by an earlier run, keyed by VMA count and
+ * variant.
+ */
+bool
+read_baseline(
+    const char *path,
+    map<pair<size_t, string>, double> &mins
+) {
+    ifstream in(path);
+    if (!in) {
+        perror(path);
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || '#' == line[0]) continue;
+        // vmas,variant,trials,min_us,median_us,p99_us
+        vector<string> f;
+        stringstream ss(line);
+        string tok;
+        while (getline(ss, tok, ',')) f.push_back(tok);
+        if (f.size() < 6 || "vmas" == f[0]) continue;
+        mins[make_pair(size_t(strtoull(f[0].c_str(), nullptr, 10)), f[1])] =
+            strtod(f[3].c_str(), nullptr);
+    }
+    return true;
+}
+
+//
+void
+usage(const char *argv0)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-v COUNTS] [-n TRIALS] [-c] [-r RATIO] "
+        "[-b BASELINE.csv] [-t PERCENT] [-a US]\n"
+        "  -v COUNTS   comma-separated synthetic VMA counts "
+        "(default: 100,1000,10000)\n"
+        "  -n TRIALS   timed runs per variant (default: 50)\n"
+        "  -c          write CSV instead of a table\n"
+        "  -r RATIO    parsers may cost this many times a raw read of their "
+        "file\n"
+        "              (default: 50; 0 disables the check)\n"
+        "  -b FILE     compare minimums with an earlier run's CSV\n"
+        "  -t PERCENT  slowdown tolerated relative to -b (default: 25)\n"
+        "  -a US       slowdown tolerated regardless of -t (default: 20)\n",
+        argv0
+    );
+}
+} // namespace
 
 int
 main(
     int argc,
     char **argv
 ) {
-    int mpirc;
-    int rank, numpe;
-
-    mpirc = MPI_Init(&argc, &argv);
-    MPICHK(mpirc);
+    vector<size_t> counts = {100, 1000, 10000};
+    int trials = 50;
+    bool csv = false;
+    double max_ratio = 50.0;
+    const char *baseline_path = nullptr;
+    double tolerance_pct = 25.0;
+    double tolerance_us = 20.0;
 
-    MPI_Comm_size(MPI_COMM_WORLD, &numpe);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "v:n:cr:b:t:a:h"))) {
+        switch (opt) {
+            case 'v':
+                counts = parse_counts(optarg);
+                break;
+            case 'n':
+                trials = max(1, atoi(optarg));
+                break;
+            case 'c':
+                csv = true;
+                break;
+            case 'r':
+                max_ratio = strtod(optarg, nullptr);
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 't':
+                tolerance_pct = strtod(optarg, nullptr);
+                break;
+            case 'a':
+                tolerance_us = strtod(optarg, nullptr);
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    map<pair<size_t, string>, double> baseline;
+    if (baseline_path && !read_baseline(baseline_path, baseline)) {
+        return EXIT_FAILURE;
+    }
 
-    if (rank == 0) {
+    if (csv) {
+        printf("vmas,variant,trials,min_us,median_us,p99_us\n");
+    }
+    else {
         printf(
-            "# starting smaps benchmark with %d process%s.\n",
-            numpe,
-            numpe > 1 ? "es" : ""
+            "%8s %8s %-22s %12s %12s %12s\n",
+            "# VMAs", "Total", "Variant", "Min (us)", "Median (us)",
+            "p99 (us)"
         );
     }
 
-    int n_trials = 100;
-    double *times = (double *)calloc(n_trials, sizeof(double));
-
-    for (int t = 0; t < n_trials; ++t) {
-        static const char *f_name = "/proc/self/smaps";
-        double start = MPI_Wtime();
-        FILE *smapsf = fopen(f_name, "r");
-        if (!smapsf) {
-            perror("fopen");
-            exit(EXIT_FAILURE);
+    int failures = 0;
+    synthetic_vmas vmas;
+    for (const size_t want : counts) {
+        const size_t made = vmas.create(want);
+        if (made < want) {
+            fprintf(
+                stderr, "# only %zu of %zu VMAs could be made "
+                "(see vm.max_map_count).\n", made, want
+            );
         }
-        char lbuff[PATH_MAX];
-        size_t gets_size = PATH_MAX - 1;
-        FILE *dn = fopen("/dev/null", "w");
-        while (fgets(lbuff, gets_size, smapsf)) {
-            fprintf(dn, "%s", lbuff);
-        }
-        fclose(dn);
-        fclose(smapsf);
-        double end = MPI_Wtime();
-        times[t] = end - start;
-    }
+        const size_t total = count_vmas();
 
-    for (int i = 0; i < n_trials; ++i) {
-        printf("%d: %lf s\n", rank, times[i]);
-    }
+        map<string, double> medians;
+        for (const auto &v : variants) {
+            result res;
+            if (!measure(v, trials, res)) continue;
+            res.vmas = made;
+            medians[res.name] = res.median_us;
 
-    free(times);
-    MPI_Finalize();
+            if (csv) {
+                printf(
+                    "%zu,%s,%d,%.3f,%.3f,%.3f\n", res.vmas, res.name.c_str(),
+                    res.trials, res.min_us, res.median_us, res.p99_us
+                );
+            }
+            else {
+                printf(
+                    "%8zu %8zu %-22s %12.3f %12.3f %12.3f\n", res.vmas,
+                    total, res.name.c_str(), res.min_us, res.median_us,
+                    res.p99_us
+                );
+            }
+            // Against a raw read of the same file.
+            if (max_ratio > 0.0 && v.reference &&
+                medians.count(v.reference)) {
+                const double ref = medians[v.reference];
+                if (res.median_us > max_ratio * ref) {
+                    fprintf(
+                        stderr, "# FAIL: %s at %zu VMAs: %.1fx %s "
+                        "(limit: %gx).\n", v.name, made,
+                        res.median_us / ref, v.reference, max_ratio
+                    );
+                    failures++;
+                }
+            }
+            // Against an earlier run.
+            const auto b = baseline.find(make_pair(made, res.name));
+            if (b != baseline.end() &&
+                res.min_us > b->second * (1.0 + tolerance_pct / 100.0) &&
+                res.min_us > b->second + tolerance_us) {
+                fprintf(
+                    stderr, "# FAIL: %s at %zu VMAs: min %.3f us, "
+                    "baseline %.3f us (tolerance: %g%%).\n", v.name, made,
+                    res.min_us, b->second, tolerance_pct
+                );
+                failures++;
+            }
+        }
+    }
 
-    return EXIT_SUCCESS;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
 }
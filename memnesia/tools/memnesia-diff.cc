@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * Compares two memnesia reports, e.g., of the same application before and
+ * after an MPI library upgrade. Functions and phases are matched by name and
+ * compared at their worst rank: MPI memory growth, first-contact cost, and the
+ * high memory usage watermarks. Exits with 1 if anything grew by more than
+ * the tolerance, so it can gate acceptance tests.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace {
+// Exit status when a tolerance is exceeded.
+constexpr int exit_regression = 1;
+// Exit status when a report cannot be used.
+constexpr int exit_error = 2;
+
+// Per-run values (MB), each the maximum over ranks.
+struct run_summary {
+    //
+    int nranks = 0;
+    //
+    double mpi_watermark = 0.0;
+    //
+    double all_watermark = 0.0;
+    // Function to total MPI growth.
+    map<string, double> func_growth;
+    // Function to growth over first calls.
+    map<string, double> func_first;
+    // Phase to MPI growth.
+    map<string, double> phase_mpi;
+    // Phase to application growth.
+    map<string, double> phase_app;
+};
+
+//
+struct tolerance {
+    // Absolute (MB).
+    double abs_mb = 0.5;
+    // Relative to the baseline (percent).
+    double rel_pct = 10.0;
+    //
+    bool
+    exceeded(
+        double base,
+        double now
+    ) const {
+        const double d = now - base;
+        return d > abs_mb && d > fabs(base) * rel_pct / 100.0;
+    }
+};
+
+//
+void
+usage(const char *argv0)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-a MB] [-r PERCENT] [-q] BASELINE CANDIDATE\n"
+        "  -a MB       absolute growth tolerated (default: 0.5)\n"
+        "  -r PERCENT  growth tolerated relative to the baseline "
+        "(default: 10)\n"
+        "  -q          only list what exceeds the tolerance\n"
+        "Growth beyond both tolerances is a regression (exit status %d).\n"
+        "Names missing from one report are listed, but never regress.\n",
+        argv0, exit_regression
+    );
+}
+
+//
+void
+keep_max(
+    map<string, double> &m,
+    const string &key,
+    double value
+) {
+    auto it = m.find(key);
+    if (it == m.end()) m[key] = value;
+    else it->second = max(it->second, value);
+}
+
+/**
+ * Returns the value of a '# Key: value' run info line, if it is one.
+ */
+bool
+run_info_value(
+    const string &line,
+    const string &key,
+    double &value
+) {
+    const string prefix = "# " + key + ": ";
+    if (0 != line.compare(0, prefix.size(), prefix)) return false;
+    value = strtod(line.c_str() + prefix.size(), nullptr);
+    return true;
+}
+
+/**
+ * Reads a memnesia report (one run info block per rank). Returns false if
+ * there is nothing to compare.
+ */
+bool
+summarize(
+    const string &path,
+    run_summary &sum
+) {
+    ifstream in(path);
+    if (!in) {
+        perror(path.c_str());
+        return false;
+    }
+    // Recovered reports carry no watermarks: fall back to the timelines.
+    double mpi_peak = -numeric_limits<double>::infinity();
+    double all_peak = mpi_peak;
+    bool have_watermarks = false;
+
+    string line;
+    while (getline(in, line)) {
+        double v = 0.0;
+        if (line == "# [Run Info Begin]") {
+            sum.nranks++;
+            continue;
+        }
+        if (run_info_value(
+                line, "High Memory Usage Watermark (MPI) (MB)", v)) {
+            sum.mpi_watermark = max(sum.mpi_watermark, v);
+            have_watermarks = true;
+            continue;
+        }
+        if (run_info_value(
+                line,
+                "High Memory Usage Watermark (Application + MPI) (MB)", v)) {
+            sum.all_watermark = max(sum.all_watermark, v);
+            continue;
+        }
+        if (line.empty() || '#' == line[0]) continue;
+
+        istringstream ls(line);
+        string key, name;
+        ls >> key >> name;
+        if ("MPI_FUNC_STATS" == key) {
+            // FirstCalls FirstCallTotal SteadyCalls SteadyTotal ...
+            double fcalls = 0, ftotal = 0, scalls = 0, stotal = 0;
+            if (!(ls >> fcalls >> ftotal >> scalls >> stotal)) continue;
+            keep_max(sum.func_growth, name, ftotal + stotal);
+            keep_max(sum.func_first, name, ftotal);
+        }
+        else if ("PHASE_STATS" == key) {
+            // Samples AppMin AppMax AppGrowth MPIGrowth MPINet
+            double n = 0, amin = 0, amax = 0, agrowth = 0, mgrowth = 0;
+            if (!(ls >> n >> amin >> amax >> agrowth >> mgrowth)) continue;
+            keep_max(sum.phase_app, name, agrowth);
+            keep_max(sum.phase_mpi, name, mgrowth);
+        }
+        else if ("MPI_MEM_USAGE" == key || "ALL_MEM_USAGE" == key) {
+            double t = 0, usage = 0;
+            if (!(ls >> t >> usage)) continue;
+            double &peak = ("MPI_MEM_USAGE" == key) ? mpi_peak : all_peak;
+            peak = max(peak, usage);
+        }
+    }
+    if (0 == sum.nranks) {
+        fprintf(stderr, "%s: not a memnesia report.\n", path.c_str());
+        return false;
+    }
+    if (!have_watermarks) {
+        if (isfinite(mpi_peak)) sum.mpi_watermark = mpi_peak;
+        if (isfinite(all_peak)) sum.all_watermark = all_peak;
+    }
+    return true;
+}
+
+// Prints comparisons and remembers whether any regressed.
+class differ {
+    //
+    const tolerance tol;
+    //
+    const bool quiet;
+    //
+    int num_regressions = 0;
+    //
+    int num_missing = 0;
+
+public:
+    //
+    differ(
+        const tolerance &tol,
+        bool quiet
+    ) : tol(tol)
+      , quiet(quiet) { }
+    //
+    void
+    row(
+        const string &what,
+        double base,
+        double now,
+        const char *note = ""
+    ) {
+        const bool regressed = tol.exceeded(base, now);
+        if (regressed) num_regressions++;
+        if (quiet && !regressed) return;
+        const double pct = (0.0 != base) ? 100.0 * (now - base) / fabs(base)
+                                         : 0.0;
+        string flags = regressed ? " REGRESSION" : "";
+        if (note[0]) flags += string(" (") + note + ")";
+        printf(
+            "%-32s %12.4f %12.4f %+12.4f %+9.1f%%%s\n",
+            what.c_str(), base, now, now - base, pct, flags.c_str()
+        );
+    }
+    // A name only one report has data for. There is nothing to compare it
+    // with, so it never regresses, e.g., when a report was recovered from
+    // logs, which carry no per-function or per-phase statistics.
+    void
+    missing(
+        const string &what,
+        double value,
+        bool from_baseline
+    ) {
+        num_missing++;
+        if (quiet) return;
+        char val[32];
+        snprintf(val, sizeof(val), "%.4f", value);
+        printf(
+            "%-32s %12s %12s %12s %10s (missing from %s)\n",
+            what.c_str(), from_baseline ? "-" : val, from_baseline ? val : "-",
+            "-", "-", from_baseline ? "baseline" : "candidate"
+        );
+    }
+    //
+    void
+    section(
+        const string &title,
+        const map<string, double> &base,
+        const map<string, double> &now
+    ) {
+        if (base.empty() && now.empty()) return;
+        printf("# %s\n", title.c_str());
+        set<string> names;
+        for (const auto &b : base) names.insert(b.first);
+        for (const auto &n : now) names.insert(n.first);
+        for (const auto &name : names) {
+            const auto b = base.find(name);
+            const auto n = now.find(name);
+            if (n == now.end()) {
+                missing(name, b->second, false);
+            }
+            // Without any data in the section, the baseline can't say
+            // whether the name is new.
+            else if (base.empty()) {
+                missing(name, n->second, true);
+            }
+            // New in the candidate: its growth is new growth, so it is
+            // compared with none.
+            else if (b == base.end()) {
+                row(name, 0.0, n->second, "new in candidate");
+            }
+            else {
+                row(name, b->second, n->second);
+            }
+        }
+    }
+    //
+    int
+    get_num_regressions(void) const
+    {
+        return num_regressions;
+    }
+    //
+    int
+    get_num_missing(void) const
+    {
+        return num_missing;
+    }
+};
+} // namespace
+
+int
+main(
+    int argc,
+    char **argv
+) {
+    tolerance tol;
+    bool quiet = false;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "a:r:qh"))) {
+        switch (opt) {
+            case 'a':
+                tol.abs_mb = strtod(optarg, nullptr);
+                break;
+            case 'r':
+                tol.rel_pct = strtod(optarg, nullptr);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : exit_error;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return exit_error;
+    }
+    run_summary base, now;
+    if (!summarize(argv[optind], base) ||
+        !summarize(argv[optind + 1], now)) {
+        return exit_error;
+    }
+    if (base.nranks != now.nranks) {
+        fprintf(
+            stderr, "# warning: comparing %d rank(s) with %d rank(s).\n",
+            base.nranks, now.nranks
+        );
+    }
+
+    printf("# Baseline:  %s\n", argv[optind]);
+    printf("# Candidate: %s\n", argv[optind + 1]);
+    printf(
+        "# Values are MB at the worst rank. Tolerance: +%g MB and +%g%%.\n",
+        tol.abs_mb, tol.rel_pct
+    );
+    printf(
+        "%-32s %12s %12s %12s %10s\n",
+        "# Name", "Baseline", "Candidate", "Change", "Change%"
+    );
+    differ diff(tol, quiet);
+    printf("# High Memory Usage Watermarks\n");
+    diff.row("MPI", base.mpi_watermark, now.mpi_watermark);
+    diff.row("Application + MPI", base.all_watermark, now.all_watermark);
+    diff.section(
+        "MPI Memory Growth Per Function", base.func_growth, now.func_growth
+    );
+    diff.section(
+        "First-Contact Cost Per Function", base.func_first, now.func_first
+    );
+    diff.section("MPI Memory Growth Per Phase", base.phase_mpi, now.phase_mpi);
+    diff.section(
+        "Application Memory Growth Per Phase", base.phase_app, now.phase_app
+    );
+
+    const int nreg = diff.get_num_regressions();
+    if (diff.get_num_missing() > 0) {
+        printf(
+            "# %d name(s) missing from one report, not compared\n",
+            diff.get_num_missing()
+        );
+    }
+    printf("# %d regression(s)\n", nreg);
+
+    return nreg ? exit_regression : EXIT_SUCCESS;
+}
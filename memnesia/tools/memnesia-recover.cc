@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * Recovers the memory usage timelines of a run from its per-rank sample logs
+ * (see MEMNESIA_LOG_RECORDS), e.g., after the job was killed or aborted, and
+ * writes them as a memnesia report that memnesia-report can process.
+ */
+
+#include "memnesia.h"
+#include "memnesia-log.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace {
+//
+void
+usage(const char *argv0)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-o REPORT] LOG...\n"
+        "  -o REPORT  write the recovered report here (default: stdout)\n",
+        argv0
+    );
+}
+
+//
+const char *
+state_name(int32_t state)
+{
+    switch (state) {
+        case MEMNESIA_LOG_OPEN:      return "not sealed (killed?)";
+        case MEMNESIA_LOG_FINALIZED: return "finalized";
+        case MEMNESIA_LOG_SIGNALED:  return "sealed by signal";
+        case MEMNESIA_LOG_ABORTED:   return "aborted";
+        default:                     return "unknown";
+    }
+}
+
+/**
+ * Appends the report of one rank to report. Returns false if the log is
+ * unusable.
+ */
+bool
+recover(
+    const string &path,
+    int32_t &rank,
+    string &report
+) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (-1 == fd) {
+        perror(path.c_str());
+        return false;
+    }
+    struct stat sb;
+    if (-1 == fstat(fd, &sb) ||
+        size_t(sb.st_size) < MEMNESIA_LOG_HEADER_SIZE) {
+        fprintf(stderr, "%s: not a memnesia log.\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    const size_t size = size_t(sb.st_size);
+    void *log = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == log) {
+        perror("mmap");
+        return false;
+    }
+
+    const auto *hdr = static_cast<const memnesia_log_header *>(log);
+    if (MEMNESIA_LOG_MAGIC != hdr->magic ||
+        MEMNESIA_LOG_VERSION != hdr->version ||
+        0 == hdr->capacity ||
+        memnesia_log_size(hdr->capacity) > size) {
+        fprintf(stderr, "%s: not a memnesia log.\n", path.c_str());
+        munmap(log, size);
+        return false;
+    }
+
+    const uint64_t nrecords = hdr->num_records.load();
+    const uint64_t first = nrecords > hdr->capacity ?
+                           nrecords - hdr->capacity : 0;
+    const memnesia_log_record *records =
+        memnesia_log_records(const_cast<void *>(log));
+
+    stringstream ss;
+    ss << "# [Run Info Begin]" << endl;
+    ss << "# Report Date Time: " << hdr->date_time << endl;
+    ss << "# Application Name: " << hdr->app_name << endl;
+    ss << "# Hostname: " << hdr->hostname << endl;
+    ss << "# MPI_COMM_WORLD Rank: " << hdr->rank << endl;
+    ss << "# MPI_COMM_WORLD Size: " << hdr->numpe << endl;
+    ss << "# [Run Info End]" << endl;
+    ss << "# Recovered from " << path << ": " << state_name(hdr->state)
+       << ", " << nrecords - first << " of " << nrecords << " records kept"
+       << endl;
+
+    stringstream mpi, app;
+    uint64_t torn = 0;
+    for (uint64_t i = first; i < nrecords; ++i) {
+        const memnesia_log_record &rec = records[i % hdr->capacity];
+        // Being written when the process went away.
+        if (rec.seq.load() != i + 1) {
+            torn++;
+            continue;
+        }
+        const string func(rec.func, strnlen(rec.func, sizeof(rec.func)));
+        mpi << "MPI_MEM_USAGE " << func << " " << rec.time << " "
+            << memnesia_util_kb2mb(rec.mpi_in_kb) << endl;
+        app << "ALL_MEM_USAGE " << func << " " << rec.time << " "
+            << memnesia_util_kb2mb(rec.app_in_kb) << endl;
+    }
+    ss << "# MPI Library Memory Usage (MB) Over Time (Since MPI_Init):"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY Function Time Usage"
+       << endl
+       << mpi.str();
+    ss << "# Application Memory Usage (MB) Over Time (Since MPI_Init):"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY Function Time Usage"
+       << endl
+       << app.str();
+
+    fprintf(
+        stderr,
+        "# rank %d (%s): %s, %" PRIu64 " records recovered, %" PRIu64
+        " overwritten, %" PRIu64 " torn, %d seal(s)\n",
+        hdr->rank, hdr->hostname, state_name(hdr->state),
+        nrecords - first - torn, first, torn, hdr->num_seals.load()
+    );
+
+    rank = hdr->rank;
+    report = ss.str();
+
+    munmap(log, size);
+    return true;
+}
+} // namespace
+
+int
+main(
+    int argc,
+    char **argv
+) {
+    const char *out_path = nullptr;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "o:h"))) {
+        switch (opt) {
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    // Emit ranks in order.
+    map<int32_t, string> rank_to_report;
+    for (int i = optind; i < argc; ++i) {
+        int32_t rank = -1;
+        string report;
+        if (recover(argv[i], rank, report)) {
+            rank_to_report[rank] += report;
+        }
+    }
+    if (rank_to_report.empty()) return EXIT_FAILURE;
+
+    ofstream outf;
+    if (out_path) {
+        outf.open(out_path);
+        if (!outf) {
+            perror(out_path);
+            return EXIT_FAILURE;
+        }
+    }
+    ostream &os = out_path ? outf : cout;
+    for (const auto &r : rank_to_report) {
+        os << r.second;
+    }
+
+    return EXIT_SUCCESS;
+}
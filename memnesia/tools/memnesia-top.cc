@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * Shows live per-rank memory usage of the memnesia-instrumented jobs running
+ * on this node by reading their telemetry segments (see MEMNESIA_TELEMETRY).
+ * No MPI traffic or file I/O is involved on the application side.
+ */
+
+#include "memnesia-telemetry.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+//
+void
+usage(const char *argv0)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-n SECONDS] [-1] [SEGMENT]\n"
+        "  -n SECONDS  refresh interval (default: 1)\n"
+        "  -1          print once and exit\n"
+        "  SEGMENT     telemetry segment name (default: all on this node)\n",
+        argv0
+    );
+}
+
+//
+vector<string>
+find_segments(void)
+{
+    vector<string> names;
+    DIR *dir = opendir("/dev/shm");
+    if (!dir) return names;
+    static const string prefix(MEMNESIA_TELEMETRY_PREFIX);
+    while (struct dirent *ent = readdir(dir)) {
+        const string name(ent->d_name);
+        if (0 == name.compare(0, prefix.size(), prefix)) {
+            names.push_back("/" + name);
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+//
+double
+to_mb(int64_t kb)
+{
+    return double(kb) / 1024.0;
+}
+
+/**
+ * Returns false if the segment is not (yet) a valid telemetry segment.
+ */
+bool
+show_segment(const string &name)
+{
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (-1 == fd) return false;
+
+    struct stat sb;
+    if (-1 == fstat(fd, &sb) ||
+        size_t(sb.st_size) < MEMNESIA_TELEMETRY_HEADER_SIZE) {
+        close(fd);
+        return false;
+    }
+    const size_t size = size_t(sb.st_size);
+    void *seg = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == seg) return false;
+
+    const auto *hdr = static_cast<const memnesia_telemetry_header *>(seg);
+    if (MEMNESIA_TELEMETRY_MAGIC != hdr->magic ||
+        MEMNESIA_TELEMETRY_VERSION != hdr->version ||
+        memnesia_telemetry_size(hdr->nslots) > size) {
+        munmap(seg, size);
+        return false;
+    }
+
+    printf(
+        "# %s: %s on %s (%d of %d processes)\n",
+        name.c_str(), hdr->app_name, hdr->hostname,
+        hdr->nslots, hdr->world_size
+    );
+    printf(
+        "%6s %8s %10s %10s %10s %10s %10s  %s\n",
+        "RANK", "PID", "TIME(s)", "APP(MB)", "APPHWM(MB)", "MPI(MB)",
+        "SAMPLES", "IN"
+    );
+
+    int64_t app_total = 0, mpi_total = 0;
+    const memnesia_telemetry_slot *slots =
+        memnesia_telemetry_slots(const_cast<void *>(seg));
+    for (int32_t i = 0; i < hdr->nslots; ++i) {
+        memnesia_telemetry_record rec;
+        if (!memnesia_telemetry_read(slots[i], rec)) {
+            printf("%6s (busy)\n", "?");
+            continue;
+        }
+        // Not attached yet.
+        if (0 == rec.pid) continue;
+        // A rank that is gone, e.g., after a crash.
+        const bool alive = (0 == kill(rec.pid, 0));
+        if (!rec.instrumented) {
+            printf(
+                "%6d %8d %10s  (not instrumented)%s\n",
+                rec.rank, rec.pid, "-", alive ? "" : " (exited)"
+            );
+            continue;
+        }
+        printf(
+            "%6d %8d %10.2f %10.2f %10.2f %10.2f %10" PRIu64 "  %s%s\n",
+            rec.rank, rec.pid, rec.time,
+            to_mb(rec.app_in_kb), to_mb(rec.app_hwm_in_kb),
+            to_mb(rec.mpi_in_kb), rec.samples,
+            rec.func[0] ? rec.func : "-",
+            alive ? "" : " (exited)"
+        );
+        app_total += rec.app_in_kb;
+        mpi_total += rec.mpi_in_kb;
+    }
+    printf(
+        "%6s %8s %10s %10.2f %10s %10.2f\n\n",
+        "TOTAL", "", "", to_mb(app_total), "", to_mb(mpi_total)
+    );
+
+    munmap(seg, size);
+    return true;
+}
+} // namespace
+
+int
+main(
+    int argc,
+    char **argv
+) {
+    double interval = 1.0;
+    bool once = false;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "n:1h"))) {
+        switch (opt) {
+            case 'n':
+                interval = atof(optarg);
+                break;
+            case '1':
+                once = true;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (interval <= 0.0) interval = 1.0;
+
+    vector<string> names;
+    if (optind < argc) {
+        string name(argv[optind]);
+        if (name[0] != '/') name = "/" + name;
+        names.push_back(name);
+    }
+
+    while (true) {
+        if (!once) {
+            // Clear the screen and home the cursor.
+            printf("\033[2J\033[H");
+        }
+        const vector<string> segs = names.empty() ? find_segments() : names;
+        int shown = 0;
+        for (const auto &name : segs) {
+            shown += show_segment(name) ? 1 : 0;
+        }
+        if (0 == shown) {
+            printf("# No memnesia telemetry segments found.\n");
+        }
+        fflush(stdout);
+        if (once) break;
+        usleep(useconds_t(interval * 1e6));
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * Optional application interface to memnesia-trace.so.
+ *
+ * The symbols are declared weak, so applications that use this interface need
+ * not link against memnesia. Check for the tool's presence before calling into
+ * it. For example,
+ *
+ *     if (memnesia_mark) memnesia_mark("assembly");
+ *
+ * Phases can also be marked without this header through MPI_Pcontrol:
+ *
+ *     MPI_Pcontrol(0);             // Disable instrumentation.
+ *     MPI_Pcontrol(1);             // Enable instrumentation.
+ *     MPI_Pcontrol(2, "assembly"); // Enable instrumentation and mark a phase.
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef MEMNESIA_API_DEFINE
+#define MEMNESIA_API __attribute__((visibility("default")))
+#else
+#define MEMNESIA_API __attribute__((weak))
+#endif
+
+/**
+ * Marks the beginning of the application phase named label. Memory usage is
+ * attributed to that phase until the next phase is marked.
+ */
+MEMNESIA_API void
+memnesia_mark(const char *label);
+
+/**
+ * Captures an application memory usage sample named label.
+ */
+MEMNESIA_API void
+memnesia_sample_now(const char *label);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-arena.h"
+#include "memnesia.h"
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+// Linux 5.17+, with CONFIG_ANON_VMA_NAME.
+#ifndef PR_SET_VMA
+#define PR_SET_VMA 0x53564d41
+#endif
+#ifndef PR_SET_VMA_ANON_NAME
+#define PR_SET_VMA_ANON_NAME 0
+#endif
+
+using namespace std;
+
+namespace {
+// Small blocks come in power-of-two size classes from min_block to max_small
+// bytes. Larger ones are whole pages.
+constexpr size_t min_block = 16;
+//
+constexpr int num_classes = 9;
+//
+constexpr size_t max_small = min_block << (num_classes - 1);
+// The reservation is committed this many bytes at a time.
+constexpr size_t commit_step = size_t(1) << 20;
+// Address space reserved by default. Only what is used becomes resident.
+constexpr size_t default_reserve_mb = 4096;
+//
+constexpr int max_excluded = 16;
+
+struct free_block {
+    //
+    free_block *next;
+    // Only used on the large list.
+    size_t size;
+};
+
+struct excluded_range {
+    //
+    uintptr_t lo;
+    //
+    uintptr_t hi;
+};
+
+// All of the state is constant-initialized, so the arena works from the first
+// static constructor that allocates.
+std::atomic_flag lock = ATOMIC_FLAG_INIT;
+//
+bool initialized = false;
+//
+bool is_labeled = false;
+//
+bool warned_full = false;
+//
+char *base = nullptr;
+// Next unused byte.
+char *brk = nullptr;
+// End of the committed (read-write) part of the reservation.
+char *committed = nullptr;
+// End of the reservation.
+char *limit = nullptr;
+//
+size_t page_size = 0;
+//
+size_t bytes_in_use = 0;
+//
+free_block *small_free[num_classes];
+// Sorted by address, so neighbors can be coalesced.
+free_block *large_free = nullptr;
+//
+excluded_range excluded[max_excluded];
+
+struct lock_guard {
+    lock_guard(void)
+    {
+        while (lock.test_and_set(std::memory_order_acquire)) { }
+    }
+    ~lock_guard(void)
+    {
+        lock.clear(std::memory_order_release);
+    }
+};
+
+//
+size_t
+round_up(
+    size_t n,
+    size_t to
+) {
+    return (n + to - 1) / to * to;
+}
+
+/**
+ * Reserves the arena's address space. Reserved but uncommitted pages cost no
+ * memory (nor commit charge).
+ */
+void
+init(void)
+{
+    initialized = true;
+    page_size = size_t(sysconf(_SC_PAGESIZE));
+
+    size_t reserve_mb = default_reserve_mb;
+    if (const char *env = getenv(MEMNESIA_ENV_ARENA_MB)) {
+        reserve_mb = size_t(strtoull(env, nullptr, 10));
+    }
+    if (0 == reserve_mb) return;
+
+    const size_t len = reserve_mb << 20;
+    void *p = mmap(
+        nullptr, len, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+    );
+    if (MAP_FAILED == p) {
+        perror("mmap");
+        fprintf(stderr, "# memnesia: tool arena disabled.\n");
+        return;
+    }
+    base = brk = committed = static_cast<char *>(p);
+    limit = base + len;
+    // Naming is optional: the samplers go by address.
+    is_labeled = (0 == prctl(
+        PR_SET_VMA, PR_SET_VMA_ANON_NAME,
+        (unsigned long)p, (unsigned long)len, (unsigned long)"memnesia"
+    ));
+}
+
+/**
+ * Returns nullptr when the reservation is used up.
+ */
+void *
+bump(
+    size_t nbytes,
+    size_t align
+) {
+    char *p = base + round_up(size_t(brk - base), align);
+    if (p + nbytes > limit) return nullptr;
+    if (p + nbytes > committed) {
+        const size_t grow = round_up(
+            size_t(p + nbytes - committed), commit_step
+        );
+        const size_t len = std::min(grow, size_t(limit - committed));
+        if (0 != mprotect(committed, len, PROT_READ | PROT_WRITE)) {
+            return nullptr;
+        }
+        committed += len;
+    }
+    brk = p + nbytes;
+    return p;
+}
+
+//
+int
+size_class(size_t nbytes)
+{
+    int cls = 0;
+    while ((min_block << cls) < nbytes) ++cls;
+    return cls;
+}
+
+//
+void *
+allocate_small(size_t nbytes)
+{
+    const int cls = size_class(nbytes);
+    if (free_block *b = small_free[cls]) {
+        small_free[cls] = b->next;
+        return b;
+    }
+    return bump(min_block << cls, min_block);
+}
+
+//
+void
+deallocate_small(
+    void *p,
+    size_t nbytes
+) {
+    const int cls = size_class(nbytes);
+    free_block *b = static_cast<free_block *>(p);
+    b->next = small_free[cls];
+    small_free[cls] = b;
+}
+
+/**
+ * First fit over the free list, else fresh pages.
+ */
+void *
+allocate_large(size_t nbytes)
+{
+    const size_t need = round_up(nbytes, page_size);
+    for (free_block **bp = &large_free; *bp; bp = &(*bp)->next) {
+        free_block *b = *bp;
+        if (b->size < need) continue;
+        if (b->size == need) {
+            *bp = b->next;
+        }
+        else {
+            free_block *rest = reinterpret_cast<free_block *>(
+                reinterpret_cast<char *>(b) + need
+            );
+            rest->next = b->next;
+            rest->size = b->size - need;
+            *bp = rest;
+        }
+        return b;
+    }
+    return bump(need, page_size);
+}
+
+/**
+ * Gives the pages back to the system, keeping only the first for the list
+ * entry, and merges the block with its free neighbors.
+ */
+void
+deallocate_large(
+    void *p,
+    size_t nbytes
+) {
+    const size_t size = round_up(nbytes, page_size);
+    char *cp = static_cast<char *>(p);
+    if (size > page_size) {
+        (void)madvise(cp + page_size, size - page_size, MADV_DONTNEED);
+    }
+    free_block *b = static_cast<free_block *>(p);
+    b->size = size;
+
+    free_block *prev = nullptr, *next = large_free;
+    while (next && next < b) {
+        prev = next;
+        next = next->next;
+    }
+    b->next = next;
+    if (next && cp + b->size == reinterpret_cast<char *>(next)) {
+        b->size += next->size;
+        b->next = next->next;
+    }
+    if (prev && reinterpret_cast<char *>(prev) + prev->size == cp) {
+        prev->size += b->size;
+        prev->next = b->next;
+    }
+    else if (prev) {
+        prev->next = b;
+    }
+    else {
+        large_free = b;
+    }
+}
+
+//
+bool
+in_arena(const void *p)
+{
+    return base && p >= base && p < limit;
+}
+} // namespace
+
+/**
+ * Falls back to malloc(3) if the arena is disabled or full.
+ */
+void *
+memnesia_arena::allocate(size_t nbytes)
+{
+    if (0 == nbytes) nbytes = 1;
+
+    void *p = nullptr;
+    {
+        lock_guard g;
+        if (!initialized) init();
+        if (base) {
+            p = (nbytes <= max_small) ? allocate_small(nbytes) :
+                                        allocate_large(nbytes);
+            if (p) {
+                bytes_in_use += nbytes;
+            }
+            else if (!warned_full) {
+                warned_full = true;
+                fprintf(
+                    stderr, "# memnesia: tool arena full, "
+                    "falling back to the application heap "
+                    "(see %s).\n", MEMNESIA_ENV_ARENA_MB
+                );
+            }
+        }
+    }
+    if (!p) {
+        p = malloc(nbytes);
+        if (!p) throw std::bad_alloc();
+    }
+    return p;
+}
+
+/**
+ *
+ */
+void
+memnesia_arena::deallocate(
+    void *p,
+    size_t nbytes
+) {
+    if (!p) return;
+    if (0 == nbytes) nbytes = 1;
+
+    if (!in_arena(p)) {
+        free(p);
+        return;
+    }
+    lock_guard g;
+    if (nbytes <= max_small) {
+        deallocate_small(p, nbytes);
+    }
+    else {
+        deallocate_large(p, nbytes);
+    }
+    bytes_in_use -= nbytes;
+}
+
+/**
+ * Mappings are matched by containment, since the kernel may split the
+ * arena's mapping into several (e.g., committed and not).
+ */
+bool
+memnesia_arena::is_tool_mapping(
+    uintptr_t lo,
+    uintptr_t hi
+) {
+    if (base && lo >= uintptr_t(base) && hi <= uintptr_t(limit)) return true;
+    for (int i = 0; i < max_excluded; ++i) {
+        const auto &r = excluded[i];
+        if (r.hi != 0 && lo >= r.lo && hi <= r.hi) return true;
+    }
+    return false;
+}
+
+/**
+ *
+ */
+void
+memnesia_arena::exclude_range(
+    const void *addr,
+    size_t len
+) {
+    lock_guard g;
+    for (int i = 0; i < max_excluded; ++i) {
+        if (0 != excluded[i].hi) continue;
+        const uintptr_t lo = uintptr_t(addr);
+        // Whole pages, as they appear in smaps.
+        const size_t ps = size_t(sysconf(_SC_PAGESIZE));
+        excluded[i].lo = lo / ps * ps;
+        excluded[i].hi = uintptr_t(round_up(lo + len, ps));
+        return;
+    }
+}
+
+/**
+ *
+ */
+void
+memnesia_arena::forget_range(const void *addr)
+{
+    lock_guard g;
+    const size_t ps = size_t(sysconf(_SC_PAGESIZE));
+    const uintptr_t lo = uintptr_t(addr) / ps * ps;
+    for (int i = 0; i < max_excluded; ++i) {
+        if (excluded[i].lo == lo) excluded[i] = excluded_range();
+    }
+}
+
+/**
+ *
+ */
+bool
+memnesia_arena::enabled(void)
+{
+    lock_guard g;
+    if (!initialized) init();
+    return base != nullptr;
+}
+
+/**
+ *
+ */
+bool
+memnesia_arena::labeled(void)
+{
+    return is_labeled;
+}
+
+/**
+ *
+ */
+size_t
+memnesia_arena::get_bytes_in_use(void)
+{
+    lock_guard g;
+    return bytes_in_use;
+}
+
+/**
+ *
+ */
+size_t
+memnesia_arena::get_bytes_committed(void)
+{
+    lock_guard g;
+    return size_t(committed - base);
+}
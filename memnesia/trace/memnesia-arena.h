@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * The tool's own heap. memnesia's internal containers allocate from a private
+ * mmap(2) arena instead of the application's glibc heap, so their growth is
+ * not counted as application (or MPI) memory usage. The arena is a single
+ * reserved address range that is committed as it fills; it is labeled
+ * [anon:memnesia] where the kernel supports PR_SET_VMA_ANON_NAME. The samplers
+ * skip it, and any other tool mapping registered with exclude_range(), by
+ * address.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <new>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class memnesia_arena {
+public:
+    //
+    static void *
+    allocate(size_t nbytes);
+    // nbytes must match the size given to allocate().
+    static void
+    deallocate(
+        void *p,
+        size_t nbytes
+    );
+    // Whether or not the mapping [lo, hi) belongs to the tool.
+    static bool
+    is_tool_mapping(
+        uintptr_t lo,
+        uintptr_t hi
+    );
+    // Registers other tool mappings (e.g., the sample log) for exclusion.
+    static void
+    exclude_range(
+        const void *addr,
+        size_t len
+    );
+    //
+    static void
+    forget_range(const void *addr);
+    // Whether or not the arena is in use (see MEMNESIA_ARENA_MB).
+    static bool
+    enabled(void);
+    // Whether or not the kernel took the arena's name.
+    static bool
+    labeled(void);
+    // Bytes handed out and not yet returned.
+    static size_t
+    get_bytes_in_use(void);
+    // Bytes of the reservation committed so far.
+    static size_t
+    get_bytes_committed(void);
+};
+
+/**
+ * Standard allocator over memnesia_arena.
+ */
+template <typename T>
+struct memnesia_allocator {
+    //
+    typedef T value_type;
+    //
+    memnesia_allocator(void) = default;
+    //
+    template <typename U>
+    memnesia_allocator(const memnesia_allocator<U> &) { }
+    //
+    T *
+    allocate(size_t n)
+    {
+        return static_cast<T *>(memnesia_arena::allocate(n * sizeof(T)));
+    }
+    //
+    void
+    deallocate(
+        T *p,
+        size_t n
+    ) {
+        memnesia_arena::deallocate(p, n * sizeof(T));
+    }
+};
+
+template <typename T, typename U>
+static inline bool
+operator==(const memnesia_allocator<T> &, const memnesia_allocator<U> &)
+{
+    return true;
+}
+
+template <typename T, typename U>
+static inline bool
+operator!=(const memnesia_allocator<T> &, const memnesia_allocator<U> &)
+{
+    return false;
+}
+
+//
+typedef std::basic_string<
+    char, std::char_traits<char>, memnesia_allocator<char>
+> memnesia_string;
+// For report text built while the application runs.
+typedef std::basic_stringstream<
+    char, std::char_traits<char>, memnesia_allocator<char>
+> memnesia_stringstream;
+//
+template <typename T>
+using memnesia_vector = std::vector<T, memnesia_allocator<T>>;
+//
+template <typename K, typename V, typename C = std::less<K>>
+using memnesia_map = std::map<
+    K, V, C, memnesia_allocator<std::pair<const K, V>>
+>;
+//
+template <typename T, typename C = std::less<T>>
+using memnesia_set = std::set<T, C, memnesia_allocator<T>>;
+//
+template <typename K, typename V, typename H = std::hash<K>>
+using memnesia_unordered_map = std::unordered_map<
+    K, V, H, std::equal_to<K>, memnesia_allocator<std::pair<const K, V>>
+>;
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-callsite.h"
+#include "memnesia.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <unwind.h>
+
+using namespace std;
+
+namespace {
+
+struct unwind_state {
+    //
+    uintptr_t self_lo = 0;
+    //
+    uintptr_t self_hi = 0;
+    //
+    int depth = 0;
+    //
+    memnesia_callsite_table::stack *frames = nullptr;
+};
+
+struct phdr_query {
+    //
+    uintptr_t base = 0;
+    //
+    uintptr_t lo = 0;
+    //
+    uintptr_t hi = 0;
+};
+
+/**
+ *
+ */
+_Unwind_Reason_Code
+unwind_cb(
+    struct _Unwind_Context *ctx,
+    void *arg
+) {
+    unwind_state *us = static_cast<unwind_state *>(arg);
+
+    const uintptr_t pc = uintptr_t(_Unwind_GetIP(ctx));
+    if (0 == pc) return _URC_END_OF_STACK;
+    // Skip frames that belong to the tool (the caliper and the wrapper).
+    if (pc >= us->self_lo && pc < us->self_hi) return _URC_NO_REASON;
+
+    us->frames->push_back(pc);
+
+    if (int(us->frames->size()) >= us->depth) return _URC_END_OF_STACK;
+
+    return _URC_NO_REASON;
+}
+
+/**
+ *
+ */
+int
+phdr_cb(
+    struct dl_phdr_info *info,
+    size_t size,
+    void *arg
+) {
+    (void)size;
+    phdr_query *q = static_cast<phdr_query *>(arg);
+
+    if (uintptr_t(info->dlpi_addr) != q->base) return 0;
+
+    for (int i = 0; i < int(info->dlpi_phnum); ++i) {
+        const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+        if (PT_LOAD != ph.p_type) continue;
+        const uintptr_t lo = uintptr_t(info->dlpi_addr + ph.p_vaddr);
+        const uintptr_t hi = lo + uintptr_t(ph.p_memsz);
+        if (0 == q->lo || lo < q->lo) q->lo = lo;
+        if (hi > q->hi) q->hi = hi;
+    }
+    // Found it, so stop iterating.
+    return 1;
+}
+
+/**
+ *
+ */
+bool
+resolve(
+    uintptr_t addr,
+    Dl_info &info
+) {
+    return 0 != dladdr((void *)addr, &info) && info.dli_fname;
+}
+
+/**
+ * Returns the base name of the object described by info.
+ */
+memnesia_string
+object_name(const Dl_info &info)
+{
+    const char *lib = strrchr(info.dli_fname, '/');
+    return memnesia_string(lib ? lib + 1 : info.dli_fname);
+}
+
+/**
+ *
+ */
+memnesia_string
+demangle(const char *sym)
+{
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(sym, nullptr, nullptr, &status);
+    memnesia_string name = (0 == status && demangled)
+                         ? memnesia_string(demangled)
+                         : memnesia_string(sym);
+    free(demangled);
+    return name;
+}
+
+} // namespace
+
+constexpr int32_t memnesia_callsite_table::no_callsite;
+constexpr int memnesia_callsite_table::max_depth;
+
+/**
+ *
+ */
+memnesia_callsite_table::memnesia_callsite_table(void)
+{
+    const char *depth_str = getenv(MEMNESIA_ENV_CALLSTACK_DEPTH);
+    if (depth_str) {
+        depth = atoi(depth_str);
+        if (depth < 0) depth = 0;
+        if (depth > max_depth) depth = max_depth;
+    }
+    if (enabled()) {
+        set_self_range();
+    }
+}
+
+/**
+ * Determines the address range occupied by the object that contains this
+ * code.
+ */
+void
+memnesia_callsite_table::set_self_range(void)
+{
+    Dl_info info;
+    if (0 == dladdr((void *)&memnesia_callsite_table::symbolize, &info)) {
+        return;
+    }
+
+    phdr_query q;
+    q.base = uintptr_t(info.dli_fbase);
+    // dlpi_addr is the load bias, which differs from dli_fbase for
+    // executables that are not position independent.
+    (void)dl_iterate_phdr(phdr_cb, &q);
+    if (0 == q.hi) {
+        q.base = 0;
+        (void)dl_iterate_phdr(phdr_cb, &q);
+    }
+
+    self_lo = q.lo;
+    self_hi = q.hi;
+}
+
+/**
+ * Captures the calling application's stack and returns its call site
+ * identifier.
+ */
+int32_t
+memnesia_callsite_table::capture(void)
+{
+    if (!enabled()) return no_callsite;
+
+    stack frames;
+    frames.reserve(size_t(depth));
+
+    unwind_state us;
+    us.self_lo = self_lo;
+    us.self_hi = self_hi;
+    us.depth = depth;
+    us.frames = &frames;
+
+    (void)_Unwind_Backtrace(unwind_cb, &us);
+
+    auto got = stack_ids.find(frames);
+    if (got != stack_ids.end()) return got->second;
+
+    const int32_t id = int32_t(stacks.size());
+    stacks.push_back(frames);
+    stack_ids.insert(make_pair(frames, id));
+
+    return id;
+}
+
+/**
+ * Returns a human-readable name for the given return address, including the
+ * offset into its function (or object, if unnamed) and the object's name.
+ */
+memnesia_string
+memnesia_callsite_table::symbolize(uintptr_t pc)
+{
+    // Return addresses point to the instruction after the call, so back up
+    // one to land within the calling instruction.
+    const uintptr_t addr = pc - 1;
+
+    char buff[64];
+    Dl_info info;
+    if (!resolve(addr, info)) {
+        snprintf(buff, sizeof(buff), "0x%" PRIxPTR, pc);
+        return memnesia_string(buff);
+    }
+
+    const memnesia_string lib = object_name(info);
+
+    if (!info.dli_sname) {
+        snprintf(
+            buff, sizeof(buff), "+0x%" PRIxPTR,
+            addr - uintptr_t(info.dli_fbase)
+        );
+        return lib + buff;
+    }
+
+    snprintf(
+        buff, sizeof(buff), "+0x%" PRIxPTR,
+        addr - uintptr_t(info.dli_saddr)
+    );
+
+    return demangle(info.dli_sname) + buff + " (" + lib + ")";
+}
+
+/**
+ * Returns the name of the function that contains the given return address,
+ * without offsets, so that calls from the same function can be merged.
+ */
+memnesia_string
+memnesia_callsite_table::function_name(uintptr_t pc)
+{
+    const uintptr_t addr = pc - 1;
+
+    char buff[64];
+    Dl_info info;
+    if (!resolve(addr, info)) {
+        snprintf(buff, sizeof(buff), "0x%" PRIxPTR, pc);
+        return memnesia_string(buff);
+    }
+
+    if (!info.dli_sname) {
+        snprintf(
+            buff, sizeof(buff), "+0x%" PRIxPTR,
+            addr - uintptr_t(info.dli_fbase)
+        );
+        return object_name(info) + buff;
+    }
+
+    return demangle(info.dli_sname);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include "memnesia-arena.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Hash-consed table of application call stacks. Each distinct stack is stored
+ * once and is referred to by its small integer identifier. Stacks are captured
+ * as raw return addresses and are only symbolized at report time.
+ */
+class memnesia_callsite_table {
+public:
+    //
+    typedef memnesia_vector<uintptr_t> stack;
+    //
+    static constexpr int32_t no_callsite = -1;
+    //
+    static constexpr int max_depth = 64;
+
+private:
+    //
+    struct stack_hash {
+        size_t
+        operator()(const stack &s) const
+        {
+            // FNV-1a over the frame addresses.
+            uint64_t h = 14695981039346656037ULL;
+            for (const auto pc : s) {
+                h ^= uint64_t(pc);
+                h *= 1099511628211ULL;
+            }
+            return size_t(h);
+        }
+    };
+    // Maximum number of application frames captured per call site.
+    int depth = 0;
+    // Address range of the tool's own text, so its frames can be skipped.
+    uintptr_t self_lo = 0, self_hi = 0;
+    //
+    memnesia_vector<stack> stacks;
+    //
+    memnesia_unordered_map<stack, int32_t, stack_hash> stack_ids;
+    //
+    void
+    set_self_range(void);
+
+public:
+    //
+    memnesia_callsite_table(void);
+    //
+    ~memnesia_callsite_table(void) = default;
+    //
+    memnesia_callsite_table(const memnesia_callsite_table &that) = delete;
+    //
+    memnesia_callsite_table &
+    operator=(const memnesia_callsite_table &) = delete;
+    //
+    bool
+    enabled(void) const
+    {
+        return depth > 0;
+    }
+    //
+    int
+    get_depth(void) const
+    {
+        return depth;
+    }
+    //
+    int32_t
+    capture(void);
+    //
+    size_t
+    size(void) const
+    {
+        return stacks.size();
+    }
+    //
+    const stack &
+    get_stack(int32_t id) const
+    {
+        return stacks[size_t(id)];
+    }
+    //
+    static memnesia_string
+    symbolize(uintptr_t pc);
+    //
+    static memnesia_string
+    function_name(uintptr_t pc);
+};
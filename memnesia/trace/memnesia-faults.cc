@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-faults.h"
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+namespace {
+/**
+ * No glibc wrapper exists.
+ */
+int
+perf_event_open(
+    struct perf_event_attr *attr,
+    int group_fd
+) {
+    return int(syscall(
+        __NR_perf_event_open, attr, 0 /* this thread */, -1 /* any cpu */,
+        group_fd, PERF_FLAG_FD_CLOEXEC
+    ));
+}
+} // namespace
+
+/**
+ *
+ */
+memnesia_fault_counters::~memnesia_fault_counters(void)
+{
+    close();
+}
+
+/**
+ *
+ */
+bool
+memnesia_fault_counters::open(void)
+{
+    static const uint64_t configs[3] = {
+        PERF_COUNT_SW_PAGE_FAULTS,
+        PERF_COUNT_SW_PAGE_FAULTS_MIN,
+        PERF_COUNT_SW_PAGE_FAULTS_MAJ
+    };
+    for (int i = 0; i < 3; ++i) {
+        struct perf_event_attr attr;
+        (void)memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (0 == i) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fds[i] = perf_event_open(&attr, fds[0]);
+        if (-1 == fds[i]) {
+            perror("perf_event_open");
+            close();
+            return false;
+        }
+    }
+    (void)ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    (void)ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+/**
+ * With PERF_FORMAT_GROUP, one read returns the number of events followed by
+ * their values, in the order they were added to the group.
+ */
+bool
+memnesia_fault_counters::read(counts &c) const
+{
+    if (!enabled()) return false;
+
+    uint64_t buff[1 + 3];
+    if (ssize_t(sizeof(buff)) != ::read(fds[0], buff, sizeof(buff)) ||
+        3 != buff[0]) {
+        return false;
+    }
+    c.faults = buff[1];
+    c.minor = buff[2];
+    c.major = buff[3];
+    return true;
+}
+
+/**
+ *
+ */
+void
+memnesia_fault_counters::close(void)
+{
+    for (int i = 2; i >= 0; --i) {
+        if (-1 != fds[i]) (void)::close(fds[i]);
+        fds[i] = -1;
+    }
+}
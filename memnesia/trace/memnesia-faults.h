@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdint.h>
+
+/**
+ * Page-fault counts of the calling thread from a perf_event_open(2) group of
+ * software events, read with a single read(2). Software events need neither
+ * PMU hardware nor privileges as long as perf_event_paranoid <= 2.
+ */
+class memnesia_fault_counters {
+public:
+    //
+    struct counts {
+        //
+        uint64_t faults = 0;
+        //
+        uint64_t minor = 0;
+        //
+        uint64_t major = 0;
+    };
+
+private:
+    // Group leader (page faults), then minor and major faults.
+    int fds[3] = {-1, -1, -1};
+
+public:
+    //
+    memnesia_fault_counters(void) = default;
+    //
+    ~memnesia_fault_counters(void);
+    //
+    memnesia_fault_counters(const memnesia_fault_counters &that) = delete;
+    //
+    memnesia_fault_counters &
+    operator=(const memnesia_fault_counters &) = delete;
+    // Counts only the calling thread from here on.
+    bool
+    open(void);
+    //
+    bool
+    enabled(void) const
+    {
+        return fds[0] != -1;
+    }
+    //
+    bool
+    read(counts &c) const;
+    //
+    void
+    close(void);
+};
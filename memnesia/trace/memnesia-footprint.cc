@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-footprint.h"
+#include "memnesia.h"
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+namespace {
+// Upper bound on the number of grid points kept per rank.
+constexpr size_t max_grid_points = 1 << 16;
+}
+
+/**
+ *
+ */
+void
+memnesia_node_footprint::init(void)
+{
+    const char *interval = getenv(MEMNESIA_ENV_NODE_GRID);
+    if (interval) grid_interval = atof(interval);
+}
+
+/**
+ * Records the latest values seen in the grid cell containing since_origin, on
+ * rank 0's clock, so that the ranks of a node agree on each cell.
+ * Cells without samples inherit the values of the cell before them.
+ */
+void
+memnesia_node_footprint::add_grid_point(
+    double since_origin,
+    const grid_point &point
+) {
+    if (!grid_enabled() || since_origin < 0.0) return;
+
+    const size_t bin = size_t(since_origin / grid_interval);
+    if (bin >= max_grid_points) return;
+
+    if (grid.empty()) {
+        grid.resize(bin + 1, point);
+    }
+    else if (grid.size() <= bin) {
+        grid.resize(bin + 1, grid.back());
+    }
+    grid[bin] = point;
+}
+
+/**
+ * Ranks without samples (e.g., uninstrumented ones) pad with points that have
+ * no ranks, so that node sums don't pass them off as complete.
+ */
+void
+memnesia_node_footprint::pad_grid(size_t nbins)
+{
+    if (grid.size() >= nbins) return;
+    grid.resize(nbins, grid.empty() ? grid_point() : grid.back());
+}
+
+/**
+ * Format:
+ * RANK Pss Private AnonShared Mpi MpiHwm
+ * SEG Dev:Inode FirstPage Pages
+ */
+std::string
+memnesia_node_footprint::serialize(
+    const memnesia_footprint_sampler::footprint &fp,
+    int64_t mpi_in_kb,
+    int64_t mpi_hwm_in_kb
+) {
+    stringstream ss;
+    ss << "RANK "
+       << fp.pss_in_kb << " "
+       << fp.private_in_kb << " "
+       << fp.anon_shared_in_kb << " "
+       << mpi_in_kb << " "
+       << mpi_hwm_in_kb << "\n";
+    for (const auto &s : fp.shared_pages) {
+        for (const auto &run : s.second) {
+            ss << "SEG " << s.first << " "
+               << run.first << " " << run.second << "\n";
+        }
+    }
+    return ss.str();
+}
+
+/**
+ * Sums per-rank values and collects every rank's shared pages, so that a page
+ * mapped by several ranks can be counted once.
+ */
+void
+memnesia_node_footprint::merge_serialized(const std::string &buff)
+{
+    stringstream ss(buff);
+    string kind;
+    while (ss >> kind) {
+        if (kind == "RANK") {
+            int64_t pss, priv, anon, mpi, mpi_hwm;
+            if (!(ss >> pss >> priv >> anon >> mpi >> mpi_hwm)) break;
+            nranks++;
+            pss_in_kb += pss;
+            private_in_kb += priv;
+            anon_shared_in_kb += anon;
+            mpi_in_kb += mpi;
+            mpi_hwm_in_kb += mpi_hwm;
+        }
+        else if (kind == "SEG") {
+            string key;
+            uint64_t first, npages;
+            if (!(ss >> key >> first >> npages)) break;
+            shared_pages[memnesia_string(key.data(), key.size())].push_back(
+                make_pair(first, npages)
+            );
+        }
+    }
+}
+
+/**
+ * The total counts every private page and every shared file or shmem page
+ * once. Shared anonymous pages can't be matched across ranks, so they are
+ * reported by proportional share and left out of it.
+ */
+void
+memnesia_node_footprint::report(
+    memnesia_stringstream &ss,
+    const std::string &hostname
+) {
+    static const int64_t page_kb = int64_t(sysconf(_SC_PAGESIZE)) / 1024;
+
+    uint64_t shared_once_pages = 0;
+    for (auto &s : shared_pages) {
+        auto &runs = s.second;
+        sort(runs.begin(), runs.end());
+        // Union of the runs.
+        uint64_t covered_to = 0;
+        for (const auto &run : runs) {
+            const uint64_t end = run.first + run.second;
+            if (end <= covered_to) continue;
+            shared_once_pages += end - max(run.first, covered_to);
+            covered_to = end;
+        }
+    }
+    const int64_t shared_once_in_kb = int64_t(shared_once_pages) * page_kb;
+    const int64_t total_in_kb = private_in_kb + shared_once_in_kb;
+    ss << "NODE_FOOTPRINT "
+       << hostname << " "
+       << nranks << " "
+       << memnesia_util_kb2mb(pss_in_kb) << " "
+       << memnesia_util_kb2mb(private_in_kb) << " "
+       << memnesia_util_kb2mb(shared_once_in_kb) << " "
+       << memnesia_util_kb2mb(anon_shared_in_kb) << " "
+       << memnesia_util_kb2mb(total_in_kb) << " "
+       << memnesia_util_kb2mb(mpi_in_kb) << " "
+       << memnesia_util_kb2mb(mpi_hwm_in_kb) << std::endl;
+}
+
+/**
+ * node_grid holds the node sums of each grid_point field, bin by bin. Bins
+ * summing fewer ranks than the node has are partial.
+ */
+void
+memnesia_node_footprint::report_grid(
+    memnesia_stringstream &ss,
+    const memnesia_vector<int64_t> &node_grid
+) {
+    for (size_t i = 0; i + grid_fields <= node_grid.size(); i += grid_fields) {
+        ss << "NODE_FOOTPRINT_GRID "
+           << double(i / grid_fields) * grid_interval << " "
+           << node_grid[i + 0] << " "
+           << memnesia_util_kb2mb(node_grid[i + 1]) << " "
+           << memnesia_util_kb2mb(node_grid[i + 2]) << " "
+           << memnesia_util_kb2mb(node_grid[i + 3]) << std::endl;
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include "memnesia-arena.h"
+#include "memnesia-sampler.h"
+
+#include <inttypes.h>
+
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Per-node memory footprint: the sum of the private (USS) and proportional
+ * (PSS) memory of the processes on a node, plus the resident pages of shared
+ * files and shmem segments, each page counted exactly once. Optionally tracked
+ * on a fixed time grid.
+ */
+class memnesia_node_footprint {
+public:
+    //
+    struct grid_point {
+        // 1 if this rank has samples, else 0, so that node sums count ranks.
+        int64_t nranks = 0;
+        //
+        int64_t pss_in_kb = 0;
+        //
+        int64_t private_in_kb = 0;
+        //
+        int64_t mpi_in_kb = 0;
+    };
+    // Number of int64_t fields in a grid_point.
+    static constexpr size_t grid_fields = 4;
+
+private:
+    // Grid resolution in seconds. Non-positive disables the time grid.
+    double grid_interval = -1.0;
+    //
+    memnesia_vector<grid_point> grid;
+    // Summed over the ranks on a node by merge().
+    int nranks = 0;
+    //
+    int64_t pss_in_kb = 0;
+    //
+    int64_t private_in_kb = 0;
+    //
+    int64_t anon_shared_in_kb = 0;
+    //
+    int64_t mpi_in_kb = 0;
+    //
+    int64_t mpi_hwm_in_kb = 0;
+    //
+    // Shared pages of every rank, keyed by "dev:inode".
+    memnesia_map<
+        memnesia_string, memnesia_footprint_sampler::page_runs
+    > shared_pages;
+
+public:
+    //
+    void
+    init(void);
+    //
+    bool
+    grid_enabled(void) const
+    {
+        return grid_interval > 0.0;
+    }
+    //
+    double
+    get_grid_interval(void) const
+    {
+        return grid_interval;
+    }
+    //
+    void
+    add_grid_point(
+        double since_origin,
+        const grid_point &point
+    );
+    //
+    memnesia_vector<grid_point> &
+    get_grid(void)
+    {
+        return grid;
+    }
+    //
+    void
+    pad_grid(size_t nbins);
+    //
+    static std::string
+    serialize(
+        const memnesia_footprint_sampler::footprint &fp,
+        int64_t mpi_in_kb,
+        int64_t mpi_hwm_in_kb
+    );
+    //
+    void
+    merge_serialized(const std::string &buff);
+    // Whether or not any rank's footprint has been merged.
+    bool
+    merged(void) const
+    {
+        return nranks > 0;
+    }
+    //
+    void
+    report(
+        memnesia_stringstream &ss,
+        const std::string &hostname
+    );
+    //
+    void
+    report_grid(
+        memnesia_stringstream &ss,
+        const memnesia_vector<int64_t> &node_grid
+    );
+};
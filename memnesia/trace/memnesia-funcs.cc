@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-funcs.h"
+#include "memnesia.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+using namespace std;
+
+const char *memnesia_func_names[MEMNESIA_FID_LAST] = {
+#define MEMNESIA_FUNC_NAME_ENTRY(name) #name,
+    MEMNESIA_FUNC_LIST(MEMNESIA_FUNC_NAME_ENTRY)
+#undef MEMNESIA_FUNC_NAME_ENTRY
+};
+
+bool memnesia_func_skipped[MEMNESIA_FID_LAST];
+
+namespace {
+/**
+ * Parses MEMNESIA_FUNCS, a comma-separated list of shell-style patterns
+ * (e.g., "MPI_Alltoall*,MPI_Comm_*") naming the functions to instrument, once
+ * at load time.
+ */
+struct func_filter_init {
+    func_filter_init(void)
+    {
+        const char *funcs = getenv(MEMNESIA_ENV_FUNCS);
+        // Not set, so instrument everything.
+        if (!funcs) return;
+
+        vector<string> patterns;
+        stringstream ss(funcs);
+        string pattern;
+        while (getline(ss, pattern, ',')) {
+            if (!pattern.empty()) patterns.push_back(pattern);
+        }
+
+        for (int fid = 0; fid < MEMNESIA_FID_LAST; ++fid) {
+            bool selected = false;
+            for (const auto &p : patterns) {
+                if (0 == fnmatch(p.c_str(), memnesia_func_names[fid], 0)) {
+                    selected = true;
+                    break;
+                }
+            }
+            memnesia_func_skipped[fid] = !selected;
+        }
+    }
+} the_func_filter_init;
+
+} // namespace
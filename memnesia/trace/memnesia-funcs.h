@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+/**
+ * Every MPI function wrapped by memnesia. Keep in sync with
+ * memnesia-pmpi.cc.
+ */
+#define MEMNESIA_FUNC_LIST(X) \
+    X(MPI_Init)               \
+    X(MPI_Irecv)              \
+    X(MPI_Send)               \
+    X(MPI_Recv)               \
+    X(MPI_Isend)              \
+    X(MPI_Sendrecv)           \
+    X(MPI_Wait)               \
+    X(MPI_Waitall)            \
+    X(MPI_Iprobe)             \
+    X(MPI_Issend)             \
+    X(MPI_Ssend)              \
+    X(MPI_Comm_size)          \
+    X(MPI_Comm_rank)          \
+    X(MPI_Barrier)            \
+    X(MPI_Allreduce)          \
+    X(MPI_Bcast)              \
+    X(MPI_Reduce)             \
+    X(MPI_Alltoall)           \
+    X(MPI_Address)            \
+    X(MPI_Comm_split)         \
+    X(MPI_Comm_free)          \
+    X(MPI_Type_commit)        \
+    X(MPI_Type_free)          \
+    X(MPI_Type_contiguous)    \
+    X(MPI_Type_struct)        \
+    X(MPI_Type_vector)
+
+#define MEMNESIA_FID(name) MEMNESIA_FID_##name
+
+enum memnesia_func_id {
+#define MEMNESIA_FUNC_ID_ENTRY(name) MEMNESIA_FID(name),
+    MEMNESIA_FUNC_LIST(MEMNESIA_FUNC_ID_ENTRY)
+#undef MEMNESIA_FUNC_ID_ENTRY
+    MEMNESIA_FID_LAST
+};
+
+// Function names, indexed by memnesia_func_id.
+extern const char *memnesia_func_names[MEMNESIA_FID_LAST];
+
+// Set at load time (see MEMNESIA_FUNCS) for every function that is not
+// instrumented. Zero-initialized, so everything is instrumented until then.
+extern bool memnesia_func_skipped[MEMNESIA_FID_LAST];
+
+/**
+ * Returns whether or not calls to the given function are instrumented.
+ */
+static inline bool
+memnesia_func_instrumented(memnesia_func_id fid)
+{
+    return !memnesia_func_skipped[fid];
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-heat.h"
+#include "memnesia.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+// Span of a bucket before any merging.
+constexpr double initial_span = 1e-3;
+//
+const char *stat_names[memnesia_heat::STAT_LAST] = {"MAX", "LAST", "MEAN"};
+//
+const char *series_names[memnesia_heat::SERIES_LAST] = {"APP", "MPI"};
+}
+
+/**
+ *
+ */
+void
+memnesia_heat::init(void)
+{
+    const char *nbuckets = getenv(MEMNESIA_ENV_HEAT_BUCKETS);
+    if (!nbuckets) return;
+
+    long n = atol(nbuckets);
+    if (n <= 0) return;
+    // Pairwise merging wants an even number.
+    n += n % 2;
+    buckets.resize(size_t(n));
+    span = initial_span;
+}
+
+/**
+ * The upper half of the buckets ends up empty.
+ */
+void
+memnesia_heat::merge_pairwise(void)
+{
+    const size_t n = buckets.size();
+    for (size_t i = 0; i < n / 2; ++i) {
+        const bucket &a = buckets[2 * i], &b = buckets[2 * i + 1];
+        bucket m;
+        for (int s = 0; s < SERIES_LAST; ++s) {
+            // An empty bucket's max is not a sample (and MPI usage can be
+            // negative).
+            m.max[s] = (0 == a.n) ? b.max[s] :
+                       (0 == b.n) ? a.max[s] : max(a.max[s], b.max[s]);
+            m.last[s] = (b.n > 0) ? b.last[s] : a.last[s];
+            m.sum[s] = a.sum[s] + b.sum[s];
+        }
+        m.n = a.n + b.n;
+        buckets[i] = m;
+    }
+    for (size_t i = n / 2; i < n; ++i) {
+        buckets[i] = bucket();
+    }
+    span *= 2.0;
+}
+
+/**
+ *
+ */
+void
+memnesia_heat::add(
+    double since_origin,
+    double app_in_mb,
+    double mpi_in_mb
+) {
+    if (!enabled() || since_origin < 0.0) return;
+
+    while (since_origin >= span * double(buckets.size())) {
+        merge_pairwise();
+    }
+    bucket &b = buckets[size_t(since_origin / span)];
+    const double vals[SERIES_LAST] = {app_in_mb, mpi_in_mb};
+    for (int s = 0; s < SERIES_LAST; ++s) {
+        b.max[s] = (0 == b.n) ? vals[s] : max(b.max[s], vals[s]);
+        b.last[s] = vals[s];
+        b.sum[s] += vals[s];
+    }
+    b.n++;
+}
+
+/**
+ *
+ */
+void
+memnesia_heat::coarsen_to(double new_span)
+{
+    if (!enabled()) return;
+    // Spans are exact powers of two times the initial span.
+    while (span < new_span * (1.0 - 1e-9)) {
+        merge_pairwise();
+    }
+}
+
+/**
+ * Row layout: for each bucket, the stats of each series, series-major.
+ * Buckets before the rank's first sample or after its last are NaN.
+ */
+void
+memnesia_heat::fill_row(double *row) const
+{
+    size_t first = buckets.size(), last = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        if (0 == buckets[i].n) continue;
+        first = min(first, i);
+        last = i;
+    }
+    double carry[SERIES_LAST] = {};
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        const bucket &b = buckets[i];
+        double *cell = row + i * row_stride;
+        if (i < first || i > last) {
+            fill(cell, cell + row_stride, NAN);
+            continue;
+        }
+        for (int s = 0; s < SERIES_LAST; ++s) {
+            double *stats = cell + s * STAT_LAST;
+            if (0 == b.n) {
+                stats[MAX] = stats[LAST] = stats[MEAN] = carry[s];
+                continue;
+            }
+            stats[MAX] = b.max[s];
+            stats[LAST] = b.last[s];
+            stats[MEAN] = b.sum[s] / double(b.n);
+            carry[s] = b.last[s];
+        }
+    }
+}
+
+/**
+ * Format:
+ * MEMNESIA_HEAT Ranks Buckets BucketSpan (s)
+ * then, for every series and stat, a line naming them (e.g., APP_MAX) followed
+ * by one line of bucket values (MB) per rank.
+ */
+void
+memnesia_heat::write_matrix(
+    std::ostream &os,
+    int nrows,
+    size_t nbuckets,
+    double span,
+    const double *rows
+) {
+    os << "MEMNESIA_HEAT " << nrows << " " << nbuckets << " " << span << endl;
+    for (int s = 0; s < SERIES_LAST; ++s) {
+        for (int st = 0; st < STAT_LAST; ++st) {
+            os << series_names[s] << "_" << stat_names[st] << endl;
+            for (int r = 0; r < nrows; ++r) {
+                const double *row = rows + size_t(r) * nbuckets * row_stride;
+                for (size_t i = 0; i < nbuckets; ++i) {
+                    os << (i ? " " : "")
+                       << row[i * row_stride + s * STAT_LAST + st];
+                }
+                os << endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include "memnesia-arena.h"
+
+#include <inttypes.h>
+
+#include <ostream>
+
+/**
+ * Fixed number of time buckets holding the max, last and mean of a rank's
+ * application (APP) and MPI memory usage, for rank x time heat maps (see
+ * MEMNESIA_HEAT_BUCKETS). When a run outlasts the buckets, adjacent buckets
+ * are merged pairwise and the bucket span doubles, so memory stays bounded
+ * regardless of run length.
+ */
+class memnesia_heat {
+public:
+    //
+    enum series_id {
+        APP = 0,
+        MPI,
+        SERIES_LAST
+    };
+    //
+    enum stat_id {
+        MAX = 0,
+        LAST,
+        MEAN,
+        STAT_LAST
+    };
+    // Values per bucket in a serialized row.
+    static constexpr int row_stride = SERIES_LAST * STAT_LAST;
+
+private:
+    //
+    struct bucket {
+        //
+        double max[SERIES_LAST] = {};
+        //
+        double last[SERIES_LAST] = {};
+        //
+        double sum[SERIES_LAST] = {};
+        //
+        int64_t n = 0;
+    };
+    //
+    memnesia_vector<bucket> buckets;
+    // Seconds per bucket.
+    double span = 0.0;
+    //
+    void
+    merge_pairwise(void);
+
+public:
+    //
+    void
+    init(void);
+    //
+    bool
+    enabled(void) const
+    {
+        return !buckets.empty();
+    }
+    //
+    size_t
+    get_num_buckets(void) const
+    {
+        return buckets.size();
+    }
+    //
+    double
+    get_span(void) const
+    {
+        return span;
+    }
+    // Values in MB, at since_origin seconds on rank 0's clock (see
+    // memnesia_clock_map), so that every rank's bucket 0 starts together.
+    void
+    add(
+        double since_origin,
+        double app_in_mb,
+        double mpi_in_mb
+    );
+    // Merges buckets until they are new_span seconds wide. Spans only ever
+    // double, so new_span is the current span times a power of two.
+    void
+    coarsen_to(double new_span);
+    // Fills row with get_num_buckets() * row_stride values. Empty buckets
+    // between samples carry the last values forward.
+    void
+    fill_row(double *row) const;
+    //
+    static void
+    write_matrix(
+        std::ostream &os,
+        int nrows,
+        size_t nbuckets,
+        double span,
+        const double *rows
+    );
+};
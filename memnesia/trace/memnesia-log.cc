@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-log.h"
+#include "memnesia-arena.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+// The log sealed by the signal handlers.
+memnesia_log *active_log = nullptr;
+//
+struct sigaction old_sigterm_action;
+//
+struct sigaction old_sigusr1_action;
+}
+
+/**
+ * Seals the log, then behaves as the signal's previous disposition would
+ * have, except that an unhandled SIGUSR1 no longer terminates the process: it
+ * becomes a request to seal the log (e.g., ahead of a walltime limit).
+ */
+void
+memnesia_log::seal_handler(
+    int sig,
+    siginfo_t *info,
+    void *ucontext
+) {
+    const int saved_errno = errno;
+
+    const bool term = (SIGTERM == sig);
+    if (active_log) {
+        active_log->seal(term ? MEMNESIA_LOG_SIGNALED : MEMNESIA_LOG_OPEN, sig);
+    }
+
+    struct sigaction *old = term ? &old_sigterm_action : &old_sigusr1_action;
+    if (old->sa_flags & SA_SIGINFO) {
+        if (old->sa_sigaction) old->sa_sigaction(sig, info, ucontext);
+    }
+    else if (SIG_DFL == old->sa_handler) {
+        if (term) {
+            (void)sigaction(sig, old, nullptr);
+            (void)raise(sig);
+        }
+    }
+    else if (SIG_IGN != old->sa_handler) {
+        old->sa_handler(sig);
+    }
+
+    errno = saved_errno;
+}
+
+/**
+ * Creates (or truncates) and preallocates the log file, so running out of
+ * space can't happen halfway through a run.
+ */
+bool
+memnesia_log::open(
+    const std::string &path,
+    uint64_t capacity,
+    int32_t rank,
+    int32_t numpe,
+    double init_time,
+    const std::string &date_time,
+    const std::string &hostname,
+    const std::string &app_name
+) {
+    const int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (-1 == fd) {
+        perror("open");
+        return false;
+    }
+    const size_t log_size = memnesia_log_size(capacity);
+    const int err = posix_fallocate(fd, 0, off_t(log_size));
+    if (0 != err) {
+        fprintf(stderr, "posix_fallocate: %s\n", strerror(err));
+        (void)::close(fd);
+        return false;
+    }
+    void *log = mmap(
+        nullptr, log_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    (void)::close(fd);
+    if (MAP_FAILED == log) {
+        perror("mmap");
+        return false;
+    }
+
+    // Tool memory, not the application's.
+    memnesia_arena::exclude_range(log, log_size);
+
+    size = log_size;
+    header = static_cast<memnesia_log_header *>(log);
+    records = memnesia_log_records(log);
+
+    header->version = MEMNESIA_LOG_VERSION;
+    header->rank = rank;
+    header->numpe = numpe;
+    header->pid = int32_t(getpid());
+    header->capacity = capacity;
+    header->init_time = init_time;
+    (void)snprintf(
+        header->date_time, sizeof(header->date_time), "%s", date_time.c_str()
+    );
+    (void)snprintf(
+        header->hostname, sizeof(header->hostname), "%s", hostname.c_str()
+    );
+    (void)snprintf(
+        header->app_name, sizeof(header->app_name), "%s", app_name.c_str()
+    );
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = MEMNESIA_LOG_MAGIC;
+
+    active_log = this;
+    struct sigaction sa;
+    (void)memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = seal_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    (void)sigemptyset(&sa.sa_mask);
+    (void)sigaction(SIGTERM, &sa, &old_sigterm_action);
+    (void)sigaction(SIGUSR1, &sa, &old_sigusr1_action);
+
+    return true;
+}
+
+/**
+ * Single writer.
+ */
+void
+memnesia_log::append(
+    double time,
+    const memnesia_string &func,
+    int64_t app_in_kb,
+    int64_t mpi_delta_in_kb,
+    int64_t mpi_in_kb,
+    uint32_t phase,
+    bool first_call
+) {
+    if (!header) return;
+
+    const uint64_t idx = header->num_records.load(std::memory_order_relaxed);
+    memnesia_log_record &rec = records[idx % header->capacity];
+    // Invalidate the slot while it is rewritten.
+    rec.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    rec.time = time;
+    rec.app_in_kb = app_in_kb;
+    rec.mpi_delta_in_kb = mpi_delta_in_kb;
+    rec.mpi_in_kb = mpi_in_kb;
+    rec.phase = phase;
+    rec.first_call = first_call ? 1 : 0;
+    (void)snprintf(rec.func, sizeof(rec.func), "%s", func.c_str());
+    rec.seq.store(idx + 1, std::memory_order_release);
+    header->num_records.store(idx + 1, std::memory_order_release);
+}
+
+/**
+ * Only touches lock-free atomics, so it is async-signal-safe.
+ */
+void
+memnesia_log::seal(
+    memnesia_log_state state,
+    int sig
+) {
+    if (!header) return;
+
+    header->sealed_records.store(
+        header->num_records.load(std::memory_order_acquire),
+        std::memory_order_relaxed
+    );
+    header->seal_signal.store(sig, std::memory_order_relaxed);
+    header->num_seals.fetch_add(1, std::memory_order_relaxed);
+    if (MEMNESIA_LOG_OPEN != state) {
+        header->state.store(state, std::memory_order_release);
+    }
+}
+
+/**
+ *
+ */
+void
+memnesia_log::close(void)
+{
+    if (!header) return;
+
+    (void)sigaction(SIGTERM, &old_sigterm_action, nullptr);
+    (void)sigaction(SIGUSR1, &old_sigusr1_action, nullptr);
+    active_log = nullptr;
+
+    seal(MEMNESIA_LOG_FINALIZED, 0);
+    (void)msync(header, size, MS_SYNC);
+    memnesia_arena::forget_range(header);
+    (void)munmap(header, size);
+    header = nullptr;
+    records = nullptr;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * Crash-resilient sample log. Each rank appends its samples to a fixed-size
+ * ring of records in a preallocated, file-backed shared mapping, so the
+ * timeline survives SIGTERM at walltime, MPI_Abort, and OOM kills: the data
+ * live in the page cache, not in the process. A record is published by
+ * writing its sequence number last, and the header's record count after
+ * that, so the file is consistent at every point. memnesia-recover turns logs
+ * back into reports.
+ */
+
+#pragma once
+
+#include "memnesia-arena.h"
+
+#include <inttypes.h>
+#include <signal.h>
+
+#include <atomic>
+#include <string>
+
+#define MEMNESIA_LOG_MAGIC   0x6d6c6f67U
+#define MEMNESIA_LOG_VERSION 2
+// Bytes reserved for the header; records follow it.
+#define MEMNESIA_LOG_HEADER_SIZE 4096
+
+enum memnesia_log_state {
+    // Still being written, or the process died without a chance to seal it.
+    MEMNESIA_LOG_OPEN = 0,
+    // MPI_Finalize completed.
+    MEMNESIA_LOG_FINALIZED,
+    // Sealed by a signal handler.
+    MEMNESIA_LOG_SIGNALED,
+    // Sealed by MPI_Abort.
+    MEMNESIA_LOG_ABORTED
+};
+
+struct memnesia_log_header {
+    //
+    uint32_t magic;
+    //
+    uint32_t version;
+    //
+    int32_t rank;
+    //
+    int32_t numpe;
+    //
+    int32_t pid;
+    // A memnesia_log_state.
+    std::atomic<int32_t> state;
+    // Signal that sealed the log, if any.
+    std::atomic<int32_t> seal_signal;
+    //
+    std::atomic<int32_t> num_seals;
+    // Number of records in the ring.
+    uint64_t capacity;
+    // Number of records written so far; the last capacity of them are kept.
+    std::atomic<uint64_t> num_records;
+    // Record count at the last seal.
+    std::atomic<uint64_t> sealed_records;
+    //
+    double init_time;
+    //
+    char date_time[64];
+    //
+    char hostname[64];
+    //
+    char app_name[192];
+};
+
+/**
+ * One caliper sample.
+ */
+struct memnesia_log_record {
+    // Index of the record plus one, written last.
+    std::atomic<uint64_t> seq;
+    // Seconds since MPI_Init.
+    double time;
+    // Application (PSS) usage after the call.
+    int64_t app_in_kb;
+    // MPI usage change across the call.
+    int64_t mpi_delta_in_kb;
+    // MPI usage after the call, i.e., the sum of all deltas so far, so that
+    // it survives the ring overwriting older records.
+    int64_t mpi_in_kb;
+    //
+    uint32_t phase;
+    //
+    uint32_t first_call;
+    //
+    char func[24];
+};
+
+static_assert(
+    sizeof(memnesia_log_header) <= MEMNESIA_LOG_HEADER_SIZE,
+    "log header too large"
+);
+
+/**
+ *
+ */
+static inline memnesia_log_record *
+memnesia_log_records(void *log)
+{
+    return reinterpret_cast<memnesia_log_record *>(
+        static_cast<char *>(log) + MEMNESIA_LOG_HEADER_SIZE
+    );
+}
+
+/**
+ *
+ */
+static inline size_t
+memnesia_log_size(uint64_t capacity)
+{
+    return MEMNESIA_LOG_HEADER_SIZE +
+           sizeof(memnesia_log_record) * size_t(capacity);
+}
+
+/**
+ * A rank's writer. There is one per process, so that signal handlers can find
+ * it.
+ */
+class memnesia_log {
+    //
+    memnesia_log_header *header = nullptr;
+    //
+    memnesia_log_record *records = nullptr;
+    //
+    size_t size = 0;
+    //
+    static void
+    seal_handler(
+        int sig,
+        siginfo_t *info,
+        void *ucontext
+    );
+
+public:
+    //
+    bool
+    open(
+        const std::string &path,
+        uint64_t capacity,
+        int32_t rank,
+        int32_t numpe,
+        double init_time,
+        const std::string &date_time,
+        const std::string &hostname,
+        const std::string &app_name
+    );
+    //
+    bool
+    enabled(void) const
+    {
+        return header != nullptr;
+    }
+    //
+    void
+    append(
+        double time,
+        const memnesia_string &func,
+        int64_t app_in_kb,
+        int64_t mpi_delta_in_kb,
+        int64_t mpi_in_kb,
+        uint32_t phase,
+        bool first_call
+    );
+    // Async-signal-safe.
+    void
+    seal(
+        memnesia_log_state state,
+        int sig
+    );
+    //
+    void
+    close(void);
+};
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-numa.h"
+#include "memnesia.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+/**
+ * MEMNESIA_NUMA is one of "phases" or "calls". Anything else (or no
+ * numa_maps) leaves NUMA sampling off.
+ */
+void
+memnesia_numa::init(void)
+{
+    const char *spec = getenv(MEMNESIA_ENV_NUMA);
+    if (!spec) return;
+
+    if (0 == strcmp(spec, "phases")) {
+        mode = PHASES;
+    }
+    else if (0 == strcmp(spec, "calls")) {
+        mode = CALLS;
+    }
+    else if (0 != strcmp(spec, "off") && 0 != strcmp(spec, "0")) {
+        fprintf(
+            stderr, "# memnesia: unknown %s '%s', ignoring.\n",
+            MEMNESIA_ENV_NUMA, spec
+        );
+        return;
+    }
+    if (enabled() && !memnesia_numa_sampler::available()) {
+        fprintf(
+            stderr, "# memnesia: %s set, but numa_maps is unavailable.\n",
+            MEMNESIA_ENV_NUMA
+        );
+        mode = OFF;
+    }
+}
+
+/**
+ *
+ */
+const char *
+memnesia_numa::get_mode_name(void) const
+{
+    switch (mode) {
+        case PHASES: return "phases";
+        case CALLS:  return "calls";
+        default:     return "off";
+    }
+}
+
+/**
+ * label must be a single report field.
+ */
+void
+memnesia_numa::take_snapshot(
+    const std::string &label,
+    double time
+) {
+    if (!enabled()) return;
+
+    snapshot snap;
+    if (!memnesia_numa_sampler::get_usage(snap.usage)) return;
+    snap.label = memnesia_string(label.c_str(), label.size());
+    snap.time = time;
+    nnodes = max(nnodes, snap.usage.nnodes);
+    snapshots.push_back(snap);
+}
+
+/**
+ *
+ */
+void
+memnesia_numa::begin_call(void)
+{
+    have_before = memnesia_numa_sampler::get_usage(before);
+}
+
+/**
+ *
+ */
+void
+memnesia_numa::end_call(const std::string &func)
+{
+    if (!have_before) return;
+    have_before = false;
+
+    memnesia_numa_sampler::usage after;
+    if (!memnesia_numa_sampler::get_usage(after)) return;
+
+    auto &fg = growth[memnesia_string(func.c_str(), func.size())];
+    fg.calls++;
+    const int n = max(before.nnodes, after.nnodes);
+    for (int i = 0; i < n; ++i) {
+        fg.node_in_kb[i] += after.node_in_kb[i] - before.node_in_kb[i];
+    }
+    nnodes = max(nnodes, n);
+}
+
+/**
+ * Every line carries the same number of node columns.
+ */
+void
+memnesia_numa::report(
+    memnesia_stringstream &ss,
+    const memnesia_clock_map &clock
+) {
+    if (!enabled() || (snapshots.empty() && growth.empty())) return;
+
+    ss << "# NUMA Node Memory Usage (MB) At Run Milestones:" << endl
+       << "# Format:" << endl
+       << "# KEY Label Time Node0 Node1 ..." << endl;
+    for (const auto &s : snapshots) {
+        ss << "NUMA_USAGE " << s.label << " "
+           << clock.since_origin(s.time);
+        for (int i = 0; i < nnodes; ++i) {
+            ss << " " << memnesia_util_kb2mb(s.usage.node_in_kb[i]);
+        }
+        ss << endl;
+    }
+    if (growth.empty()) return;
+
+    ss << "# NUMA Node Memory Usage Change (MB) Across MPI Calls:" << endl
+       << "# Format:" << endl
+       << "# KEY Function Calls Node0 Node1 ..." << endl;
+    for (const auto &g : growth) {
+        ss << "NUMA_FUNC_GROWTH " << g.first << " " << g.second.calls;
+        for (int i = 0; i < nnodes; ++i) {
+            ss << " " << memnesia_util_kb2mb(g.second.node_in_kb[i]);
+        }
+        ss << endl;
+    }
+}
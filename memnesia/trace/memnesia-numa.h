@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include "memnesia-arena.h"
+#include "memnesia-sampler.h"
+#include "memnesia-timer.h"
+
+#include <inttypes.h>
+
+#include <sstream>
+#include <string>
+
+/**
+ * NUMA placement of a rank's memory (see MEMNESIA_NUMA): per-node usage at
+ * run milestones (tool start, MPI_Init, phase boundaries, MPI_Finalize) and,
+ * optionally, per-node growth across MPI calls attributed to the function
+ * called.
+ */
+class memnesia_numa {
+public:
+    //
+    enum mode_id {
+        OFF = 0,
+        // Milestones only.
+        PHASES,
+        // Milestones and every instrumented MPI call.
+        CALLS
+    };
+
+private:
+    //
+    struct snapshot {
+        //
+        memnesia_string label;
+        //
+        double time = 0.0;
+        //
+        memnesia_numa_sampler::usage usage;
+    };
+    //
+    struct func_growth {
+        //
+        int64_t calls = 0;
+        // Net change per node.
+        int64_t node_in_kb[memnesia_numa_sampler::max_nodes] = {};
+    };
+    //
+    mode_id mode = OFF;
+    //
+    memnesia_vector<snapshot> snapshots;
+    //
+    memnesia_map<memnesia_string, func_growth> growth;
+    // Usage before the MPI call in progress.
+    memnesia_numa_sampler::usage before;
+    //
+    bool have_before = false;
+    // One past the highest node seen.
+    int nnodes = 0;
+
+public:
+    //
+    void
+    init(void);
+    //
+    bool
+    enabled(void) const
+    {
+        return OFF != mode;
+    }
+    //
+    bool
+    per_call(void) const
+    {
+        return CALLS == mode;
+    }
+    //
+    const char *
+    get_mode_name(void) const;
+    //
+    void
+    take_snapshot(
+        const std::string &label,
+        double time
+    );
+    //
+    void
+    begin_call(void);
+    //
+    void
+    end_call(const std::string &func);
+    //
+    void
+    report(
+        memnesia_stringstream &ss,
+        const memnesia_clock_map &clock
+    );
+};
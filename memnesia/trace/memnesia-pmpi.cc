@@ -7,7 +7,13 @@
  */
 
 #include "memnesia-rt.h"
+#include "memnesia-funcs.h"
+#include "memnesia-wrap.h"
 
+#define MEMNESIA_API_DEFINE
+#include "memnesia-api.h"
+
+#include <cstdarg>
 #include <iostream>
 
 #include "mpi.h"
@@ -30,11 +36,7 @@ MPI_Init(
     // Set init time.
     rt->set_init_begin_time_now();
     //
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Init(argc, argv);
-    }
+    const int rc = MEMNESIA_WRAP(MPI_Init)::call(argc, argv);
     // Set init end time.
     rt->set_init_end_time_now();
     // Now that MPI has been initialized, do tool-specific parallel
@@ -62,21 +64,15 @@ MPI_Irecv(
     MPI_Comm comm,
     MPI_Request *request
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Irecv(
-            buf,
-            count,
-            datatype,
-            source,
-            tag,
-            comm,
-            request
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Irecv)::call(
+        buf,
+        count,
+        datatype,
+        source,
+        tag,
+        comm,
+        request
+    );
 }
 
 /**
@@ -91,20 +87,14 @@ MPI_Send(
     int tag,
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Send(
-            buf,
-            count,
-            datatype,
-            dest,
-            tag,
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Send)::call(
+        buf,
+        count,
+        datatype,
+        dest,
+        tag,
+        comm
+    );
 }
 
 /**
@@ -120,21 +110,15 @@ MPI_Recv(
     MPI_Comm comm,
     MPI_Status *status
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Recv(
-            buf,
-            count,
-            datatype,
-            source,
-            tag,
-            comm,
-            status
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Recv)::call(
+        buf,
+        count,
+        datatype,
+        source,
+        tag,
+        comm,
+        status
+    );
 }
 
 /**
@@ -150,21 +134,15 @@ MPI_Isend(
     MPI_Comm comm,
     MPI_Request *request
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Isend(
-            buf,
-            count,
-            datatype,
-            dest,
-            tag,
-            comm,
-            request
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Isend)::call(
+        buf,
+        count,
+        datatype,
+        dest,
+        tag,
+        comm,
+        request
+    );
 }
 
 /**
@@ -185,26 +163,20 @@ MPI_Sendrecv(
     MPI_Comm comm,
     MPI_Status *status
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Sendrecv(
-            sendbuf,
-            sendcount,
-            sendtype,
-            dest,
-            sendtag,
-            recvbuf,
-            recvcount,
-            recvtype,
-            source,
-            recvtag,
-            comm,
-            status
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Sendrecv)::call(
+        sendbuf,
+        sendcount,
+        sendtype,
+        dest,
+        sendtag,
+        recvbuf,
+        recvcount,
+        recvtype,
+        source,
+        recvtag,
+        comm,
+        status
+    );
 }
 
 /**
@@ -215,16 +187,10 @@ MPI_Wait(
     MPI_Request *request,
     MPI_Status *status
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Wait(
-            request,
-            status
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Wait)::call(
+        request,
+        status
+    );
 }
 
 /**
@@ -236,17 +202,11 @@ MPI_Waitall(
     MPI_Request array_of_requests[],
     MPI_Status *array_of_statuses
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Waitall(
-            count,
-            array_of_requests,
-            array_of_statuses
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Waitall)::call(
+        count,
+        array_of_requests,
+        array_of_statuses
+    );
 }
 
 /**
@@ -260,19 +220,13 @@ MPI_Iprobe(
     int *flag,
     MPI_Status *status
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Iprobe(
-            source,
-            tag,
-            comm,
-            flag,
-            status
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Iprobe)::call(
+        source,
+        tag,
+        comm,
+        flag,
+        status
+    );
 }
 
 /**
@@ -288,21 +242,15 @@ MPI_Issend(
     MPI_Comm comm,
     MPI_Request *request
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Issend(
-            buf,
-            count,
-            datatype,
-            dest,
-            tag,
-            comm,
-            request
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Issend)::call(
+        buf,
+        count,
+        datatype,
+        dest,
+        tag,
+        comm,
+        request
+    );
 }
 
 /**
@@ -317,20 +265,14 @@ MPI_Ssend(
     int tag,
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Ssend(
-            buf,
-            count,
-            datatype,
-            dest,
-            tag,
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Ssend)::call(
+        buf,
+        count,
+        datatype,
+        dest,
+        tag,
+        comm
+    );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -347,16 +289,10 @@ MPI_Comm_size(
     MPI_Comm comm,
     int *size
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Comm_size(
-            comm,
-            size
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Comm_size)::call(
+        comm,
+        size
+    );
 }
 
 /**
@@ -367,16 +303,10 @@ MPI_Comm_rank(
     MPI_Comm comm,
     int *rank
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Comm_rank(
-            comm,
-            rank
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Comm_rank)::call(
+        comm,
+        rank
+    );
 }
 
 /**
@@ -386,15 +316,9 @@ int
 MPI_Barrier(
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Barrier(
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Barrier)::call(
+        comm
+    );
 }
 
 /**
@@ -409,20 +333,14 @@ MPI_Allreduce(
     MPI_Op op,
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Allreduce(
-            sendbuf,
-            recvbuf,
-            count,
-            datatype,
-            op,
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Allreduce)::call(
+        sendbuf,
+        recvbuf,
+        count,
+        datatype,
+        op,
+        comm
+    );
 }
 
 /**
@@ -436,19 +354,13 @@ MPI_Bcast(
     int root,
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Bcast(
-            buffer,
-            count,
-            datatype,
-            root,
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Bcast)::call(
+        buffer,
+        count,
+        datatype,
+        root,
+        comm
+    );
 }
 
 /**
@@ -464,21 +376,15 @@ MPI_Reduce(
     int root,
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Reduce(
-            sendbuf,
-            recvbuf,
-            count,
-            datatype,
-            op,
-            root,
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Reduce)::call(
+        sendbuf,
+        recvbuf,
+        count,
+        datatype,
+        op,
+        root,
+        comm
+    );
 }
 
 /**
@@ -494,21 +400,15 @@ MPI_Alltoall(
     MPI_Datatype recvtype,
     MPI_Comm comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Alltoall(
-            sendbuf,
-            sendcount,
-            sendtype,
-            recvbuf,
-            recvcount,
-            recvtype,
-            comm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Alltoall)::call(
+        sendbuf,
+        sendcount,
+        sendtype,
+        recvbuf,
+        recvcount,
+        recvtype,
+        comm
+    );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -517,22 +417,46 @@ MPI_Alltoall(
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 
-#if 0
 /**
- *
+ * Level 0 disables instrumentation, level 1 enables it, and level 2 enables it
+ * and marks the beginning of the application phase named by the next argument,
+ * a const char *. For example, MPI_Pcontrol(2, "assembly").
  */
-double
-MPI_Wtime(void)
-{
-    double res = 0.0;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        res = PMPI_Wtime();
+int
+MPI_Pcontrol(
+    const int level,
+    ...
+) {
+    static memnesia_rt *rt = memnesia_rt::the_memnesia_rt();
+
+    const char *label = nullptr;
+    if (MEMNESIA_PCONTROL_MARK == level) {
+        va_list args;
+        va_start(args, level);
+        label = va_arg(args, const char *);
+        va_end(args);
     }
-    //
-    return res;
+
+    switch (level) {
+        case MEMNESIA_PCONTROL_OFF:
+            rt->set_instrumentation_enabled(false);
+            break;
+        case MEMNESIA_PCONTROL_ON:
+            rt->set_instrumentation_enabled(true);
+            break;
+        case MEMNESIA_PCONTROL_MARK:
+            rt->set_instrumentation_enabled(true);
+            rt->mark_phase(label);
+            break;
+        default:
+            break;
+    }
+    // Let any other tools know about it, too.
+    if (MEMNESIA_PCONTROL_MARK == level) {
+        return PMPI_Pcontrol(level, label);
+    }
+    return PMPI_Pcontrol(level);
 }
-#endif
 
 /**
  *
@@ -542,16 +466,10 @@ MPI_Address(
     void *location,
     MPI_Aint *address
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Address(
-            location,
-            address
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Address)::call(
+        location,
+        address
+    );
 }
 
 /**
@@ -564,18 +482,12 @@ MPI_Comm_split(
     int key,
     MPI_Comm *newcomm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Comm_split(
-            comm,
-            color,
-            key,
-            newcomm
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Comm_split)::call(
+        comm,
+        color,
+        key,
+        newcomm
+    );
 }
 
 /**
@@ -585,38 +497,31 @@ int
 MPI_Comm_free(
     MPI_Comm *comm
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Comm_free(
-            comm
-        );
-    }
+    static memnesia_rt *rt = memnesia_rt::the_memnesia_rt();
+    // The handle may be reused after it is freed, so forget about it.
+    rt->forget_comm(*comm);
     //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Comm_free)::call(
+        comm
+    );
 }
 
-#if 0
 /**
- *
+ * Not instrumented, since it does not return. Seals the sample log, if any,
+ * before the job goes away.
  */
 int
 MPI_Abort(
     MPI_Comm comm,
     int errorcode
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Abort(
-            comm,
-            errorcode
-        );
-    }
+    memnesia_rt::the_memnesia_rt()->seal_log(MEMNESIA_LOG_ABORTED);
     //
-    return rc;
+    return PMPI_Abort(
+        comm,
+        errorcode
+    );
 }
-#endif
 
 /**
  *
@@ -625,15 +530,9 @@ int
 MPI_Type_commit(
     MPI_Datatype *type
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Type_commit(
-            type
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Type_commit)::call(
+        type
+    );
 }
 
 /**
@@ -643,15 +542,9 @@ int
 MPI_Type_free(
     MPI_Datatype *type
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Type_free(
-            type
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Type_free)::call(
+        type
+    );
 }
 
 /**
@@ -663,17 +556,11 @@ MPI_Type_contiguous(
     MPI_Datatype oldtype,
     MPI_Datatype *newtype
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Type_contiguous(
-            count,
-            oldtype,
-            newtype
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Type_contiguous)::call(
+        count,
+        oldtype,
+        newtype
+    );
 }
 
 /**
@@ -687,19 +574,13 @@ MPI_Type_struct(
     MPI_Datatype array_of_types[],
     MPI_Datatype *newtype
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Type_struct(
-            count,
-            array_of_blocklengths,
-            array_of_displacements,
-            array_of_types,
-            newtype
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Type_struct)::call(
+        count,
+        array_of_blocklengths,
+        array_of_displacements,
+        array_of_types,
+        newtype
+    );
 }
 
 /**
@@ -713,19 +594,36 @@ MPI_Type_vector(
     MPI_Datatype oldtype,
     MPI_Datatype *newtype
 ) {
-    int rc = MPI_ERR_UNKNOWN;
-    {
-        memnesia_scoped_caliper caliper(MEMNESIA_FUNC);
-        rc = PMPI_Type_vector(
-            count,
-            blocklength,
-            stride,
-            oldtype,
-            newtype
-        );
-    }
-    //
-    return rc;
+    return MEMNESIA_WRAP(MPI_Type_vector)::call(
+        count,
+        blocklength,
+        stride,
+        oldtype,
+        newtype
+    );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+// Application Interface
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+/**
+ *
+ */
+void
+memnesia_mark(const char *label)
+{
+    memnesia_rt::the_memnesia_rt()->mark_phase(label);
+}
+
+/**
+ *
+ */
+void
+memnesia_sample_now(const char *label)
+{
+    memnesia_rt::the_memnesia_rt()->sample_now(label);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
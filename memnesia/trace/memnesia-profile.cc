@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-profile.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+namespace {
+/**
+ * Just enough of a protocol buffer encoder to emit pprof profiles, so that no
+ * external runtime dependency is needed. See profile.proto in
+ * github.com/google/pprof for the message definitions.
+ */
+class pb_writer {
+    //
+    static constexpr int wt_varint = 0;
+    //
+    static constexpr int wt_len = 2;
+    //
+    std::string buff;
+    //
+    void
+    put_varint(uint64_t v)
+    {
+        while (v >= 0x80) {
+            buff.push_back(char(uint8_t(v) | 0x80));
+            v >>= 7;
+        }
+        buff.push_back(char(uint8_t(v)));
+    }
+    //
+    void
+    put_key(int field, int wire_type)
+    {
+        put_varint((uint64_t(field) << 3) | uint64_t(wire_type));
+    }
+
+public:
+    //
+    void
+    put_int(int field, int64_t v)
+    {
+        put_key(field, wt_varint);
+        put_varint(uint64_t(v));
+    }
+    //
+    void
+    put_bytes(int field, const std::string &v)
+    {
+        put_key(field, wt_len);
+        put_varint(uint64_t(v.size()));
+        buff.append(v);
+    }
+    //
+    void
+    put_message(int field, const pb_writer &msg)
+    {
+        put_bytes(field, msg.buff);
+    }
+    //
+    void
+    put_packed(int field, const std::vector<int64_t> &vs)
+    {
+        pb_writer packed;
+        for (const auto v : vs) {
+            packed.put_varint(uint64_t(v));
+        }
+        put_bytes(field, packed.buff);
+    }
+    //
+    const std::string &
+    str(void) const
+    {
+        return buff;
+    }
+};
+
+/**
+ * Interns strings into the profile's string table.
+ */
+class string_table {
+    //
+    std::vector<std::string> strs;
+    //
+    std::map<std::string, int64_t> ids;
+
+public:
+    //
+    string_table(void)
+    {
+        // The first entry must be the empty string.
+        (void)id("");
+    }
+    //
+    int64_t
+    id(const std::string &s)
+    {
+        auto got = ids.find(s);
+        if (got != ids.end()) return got->second;
+
+        const int64_t nid = int64_t(strs.size());
+        strs.push_back(s);
+        ids.insert(make_pair(s, nid));
+        return nid;
+    }
+    //
+    const std::vector<std::string> &
+    get(void) const
+    {
+        return strs;
+    }
+};
+
+/**
+ *
+ */
+vector<string>
+split_frames(const string &folded)
+{
+    vector<string> frames;
+    stringstream ss(folded);
+    string frame;
+    while (getline(ss, frame, ';')) {
+        frames.push_back(frame);
+    }
+    return frames;
+}
+
+/**
+ *
+ */
+bool
+write_file(
+    const string &path,
+    const string &contents
+) {
+    FILE *f = fopen(path.c_str(), "w+");
+    if (!f) {
+        fprintf(stderr, "Error saving profile to %s.\n", path.c_str());
+        return false;
+    }
+    const size_t nw = fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+
+    return nw == contents.size();
+}
+
+} // namespace
+
+/**
+ *
+ */
+void
+memnesia_profile::add(
+    const std::string &folded_stack,
+    int64_t growth_in_kb,
+    int64_t net_in_kb,
+    int64_t calls
+) {
+    auto &e = stacks[folded_stack];
+    e.growth_in_kb += growth_in_kb;
+    e.net_in_kb += net_in_kb;
+    e.calls += calls;
+}
+
+/**
+ * Format (one stack per line, the stack last since it may contain spaces):
+ * Growth Net Calls Stack
+ */
+std::string
+memnesia_profile::serialize(void) const
+{
+    stringstream ss;
+    for (const auto &si : stacks) {
+        ss << si.second.growth_in_kb << " "
+           << si.second.net_in_kb << " "
+           << si.second.calls << " "
+           << si.first << "\n";
+    }
+    return ss.str();
+}
+
+/**
+ *
+ */
+void
+memnesia_profile::merge_serialized(const std::string &buff)
+{
+    stringstream ss(buff);
+    string line;
+    while (getline(ss, line)) {
+        stringstream ls(line);
+        int64_t growth = 0, net = 0, calls = 0;
+        if (!(ls >> growth >> net >> calls)) continue;
+        // Skip the separating space.
+        (void)ls.get();
+        string folded;
+        getline(ls, folded);
+        add(folded, growth, net, calls);
+    }
+}
+
+/**
+ * Writes MPI memory growth (in kB) in the folded-stack format used by
+ * flame graph tools.
+ */
+bool
+memnesia_profile::write_folded(const std::string &path) const
+{
+    stringstream ss;
+    for (const auto &si : stacks) {
+        // Flame graphs cannot represent shrinkage.
+        if (si.second.growth_in_kb <= 0) continue;
+        ss << si.first << " " << si.second.growth_in_kb << "\n";
+    }
+    return write_file(path, ss.str());
+}
+
+/**
+ * Writes an uncompressed pprof profile with MPI memory growth, net MPI memory
+ * change, and call counts per stack.
+ */
+bool
+memnesia_profile::write_pprof(const std::string &path) const
+{
+    // Profile field numbers.
+    enum {
+        P_SAMPLE_TYPE = 1,
+        P_SAMPLE = 2,
+        P_LOCATION = 4,
+        P_FUNCTION = 5,
+        P_STRING_TABLE = 6,
+        P_PERIOD_TYPE = 11,
+        P_PERIOD = 12,
+        P_DEFAULT_SAMPLE_TYPE = 14
+    };
+    // ValueType field numbers.
+    enum { VT_TYPE = 1, VT_UNIT = 2 };
+    // Sample field numbers.
+    enum { S_LOCATION_ID = 1, S_VALUE = 2 };
+    // Location field numbers.
+    enum { L_ID = 1, L_LINE = 4 };
+    // Line field numbers.
+    enum { LN_FUNCTION_ID = 1 };
+    // Function field numbers.
+    enum { F_ID = 1, F_NAME = 2, F_SYSTEM_NAME = 3 };
+
+    string_table strtab;
+    pb_writer prof;
+
+    const char *sample_types[][2] = {
+        {"mpi_growth", "bytes"},
+        {"mpi_net", "bytes"},
+        {"calls", "count"}
+    };
+    for (const auto &st : sample_types) {
+        pb_writer vt;
+        vt.put_int(VT_TYPE, strtab.id(st[0]));
+        vt.put_int(VT_UNIT, strtab.id(st[1]));
+        prof.put_message(P_SAMPLE_TYPE, vt);
+    }
+    // Locations and functions share identifiers, one per distinct frame name.
+    map<string, int64_t> frame_ids;
+    for (const auto &si : stacks) {
+        const vector<string> frames = split_frames(si.first);
+        vector<int64_t> loc_ids;
+        // pprof wants the leaf first.
+        for (auto f = frames.rbegin(); f != frames.rend(); ++f) {
+            auto got = frame_ids.find(*f);
+            if (got != frame_ids.end()) {
+                loc_ids.push_back(got->second);
+                continue;
+            }
+            const int64_t fid = int64_t(frame_ids.size()) + 1;
+            frame_ids.insert(make_pair(*f, fid));
+            loc_ids.push_back(fid);
+        }
+
+        pb_writer sample;
+        sample.put_packed(S_LOCATION_ID, loc_ids);
+        sample.put_packed(
+            S_VALUE,
+            vector<int64_t>{
+                si.second.growth_in_kb * 1024,
+                si.second.net_in_kb * 1024,
+                si.second.calls
+            }
+        );
+        prof.put_message(P_SAMPLE, sample);
+    }
+
+    for (const auto &fi : frame_ids) {
+        pb_writer line;
+        line.put_int(LN_FUNCTION_ID, fi.second);
+
+        pb_writer loc;
+        loc.put_int(L_ID, fi.second);
+        loc.put_message(L_LINE, line);
+        prof.put_message(P_LOCATION, loc);
+
+        pb_writer func;
+        func.put_int(F_ID, fi.second);
+        func.put_int(F_NAME, strtab.id(fi.first));
+        func.put_int(F_SYSTEM_NAME, strtab.id(fi.first));
+        prof.put_message(P_FUNCTION, func);
+    }
+
+    pb_writer period_type;
+    period_type.put_int(VT_TYPE, strtab.id("calls"));
+    period_type.put_int(VT_UNIT, strtab.id("count"));
+    prof.put_message(P_PERIOD_TYPE, period_type);
+    prof.put_int(P_PERIOD, 1);
+    prof.put_int(P_DEFAULT_SAMPLE_TYPE, strtab.id("mpi_growth"));
+    // The string table must be complete before it is emitted.
+    for (const auto &s : strtab.get()) {
+        prof.put_bytes(P_STRING_TABLE, s);
+    }
+
+    return write_file(path, prof.str());
+}
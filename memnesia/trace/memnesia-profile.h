@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+
+/**
+ * MPI memory growth keyed by folded call stack (outermost frame first, frames
+ * separated by ';', the MPI function last). Used to export memnesia data to
+ * standard profile viewers.
+ */
+class memnesia_profile {
+    //
+    struct entry {
+        // Sum of positive MPI memory deltas.
+        int64_t growth_in_kb = 0;
+        // Sum of all MPI memory deltas.
+        int64_t net_in_kb = 0;
+        //
+        int64_t calls = 0;
+    };
+    //
+    std::map<std::string, entry> stacks;
+
+public:
+    //
+    void
+    add(
+        const std::string &folded_stack,
+        int64_t growth_in_kb,
+        int64_t net_in_kb,
+        int64_t calls
+    );
+    //
+    bool
+    empty(void) const
+    {
+        return stacks.empty();
+    }
+    //
+    std::string
+    serialize(void) const;
+    //
+    void
+    merge_serialized(const std::string &buff);
+    //
+    bool
+    write_folded(const std::string &path) const;
+    //
+    bool
+    write_pprof(const std::string &path) const;
+};
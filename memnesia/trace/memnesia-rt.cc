@@ -13,13 +13,42 @@
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <atomic>
 
+#include <ctype.h>
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
 
 using namespace std;
 
+namespace {
+// Set by the SIGUSR2 handler, cleared by the next caliper.
+std::atomic<bool> snapshot_requested(false);
+//
+struct sigaction old_sigusr2_action;
+
+//
+void
+snapshot_handler(
+    int sig,
+    siginfo_t *info,
+    void *ucontext
+) {
+    snapshot_requested.store(true, std::memory_order_relaxed);
+    // Chain to the application's handler, if any.
+    if (old_sigusr2_action.sa_flags & SA_SIGINFO) {
+        if (old_sigusr2_action.sa_sigaction) {
+            old_sigusr2_action.sa_sigaction(sig, info, ucontext);
+        }
+    }
+    else if (SIG_DFL != old_sigusr2_action.sa_handler &&
+             SIG_IGN != old_sigusr2_action.sa_handler) {
+        old_sigusr2_action.sa_handler(sig);
+    }
+}
+} // namespace
+
 /**
  *
  */
@@ -37,6 +66,8 @@ void
 memnesia_rt::set_init_begin_time_now(void)
 {
     init_begin_time = memnesia_time();
+    // Until sync_clocks(), timelines start at this rank's MPI_Init.
+    clock.set_origin(init_begin_time);
 }
 
 /**
@@ -135,10 +166,11 @@ memnesia_rt::get_init_end_time(void)
 void
 memnesia_rt::pinit(void)
 {
-    // TODO create tool communicator.
     setbuf(stdout, NULL);
     // Reset any signal handlers that may have been set in MPI_Init.
     (void)signal(SIGSEGV, SIG_DFL);
+    // Before the tool's own MPI resources.
+    numa.take_snapshot("MPI_Init", memnesia_time());
     // Synchronize.
     const int nsyncs = 2;
     for (int i = 0; i < nsyncs; ++i) {
@@ -154,6 +186,51 @@ memnesia_rt::pinit(void)
         perror("PMPI_Comm_size");
         memnesia_exit_failure();
     }
+    // Create tool communicators, so tool traffic never mixes with the
+    // application's.
+    if (MPI_SUCCESS != PMPI_Comm_dup(MPI_COMM_WORLD, &tool_comm)) {
+        perror("PMPI_Comm_dup");
+        memnesia_exit_failure();
+    }
+    if (MPI_SUCCESS != PMPI_Comm_split_type(
+        tool_comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm
+    )) {
+        perror("PMPI_Comm_split_type");
+        memnesia_exit_failure();
+    }
+    if (MPI_SUCCESS != PMPI_Comm_rank(node_comm, &node_rank)) {
+        perror("PMPI_Comm_rank");
+        memnesia_exit_failure();
+    }
+    if (MPI_SUCCESS != PMPI_Comm_split(
+        tool_comm, (0 == node_rank) ? 0 : MPI_UNDEFINED, rank, &leader_comm
+    )) {
+        perror("PMPI_Comm_split");
+        memnesia_exit_failure();
+    }
+    //
+    sync_clocks(false);
+    //
+    set_report_base_name();
+    //
+    set_report_formats();
+    //
+    select_ranks();
+    //
+    set_telemetry();
+    //
+    set_log();
+    //
+    set_snapshot_handler();
+    //
+    if (selected && watchdog.armed()) {
+        watchdog.set_baseline();
+    }
+    //
+    const char *start_enabled = getenv(MEMNESIA_ENV_START_ENABLED);
+    if (start_enabled && 0 == atoi(start_enabled)) {
+        set_instrumentation_enabled(false);
+    }
     // Emit obnoxious header that lets the user know something is happening.
     if (rank == 0) {
         emit_header();
@@ -164,24 +241,43 @@ memnesia_rt::pinit(void)
  *
  */
 void
-memnesia_rt::fill_report_buffer(
-    std::stringstream &ss
+memnesia_rt::fill_run_info(
+    memnesia_stringstream &ss
 ) {
     ss << "# [Run Info Begin]"      << endl;
 
     ss << "# Report Date Time: "    << get_date_time_str_now() << endl;
 
-    ss << "# Application Name: "    << get_app_name() << endl;
+    ss << "# Application Name: "    << app_comm << endl;
 
-    ss << "# Hostname: "            << get_hostname() << endl;
+    ss << "# Hostname: "            << hostname << endl;
 
     ss << "# MPI_COMM_WORLD Rank: " << rank << endl;
 
     ss << "# MPI_COMM_WORLD Size: " << numpe << endl;
 
+    ss << "# Instrumented: " << (selected ? 1 : 0) << endl;
+
+    ss << "# Sampler Backend: "
+       << memnesia_smaps_sampler::get_backend_name() << endl;
+
+    ss << "# Tool Arena (MB): "
+       << memnesia_util_kb2mb(memnesia_arena::get_bytes_in_use() / 1024)
+       << endl;
+
+    ss << "# Clock Offset (s): " << clock.get_offset() << endl;
+
+    ss << "# Clock Drift (s/s): " << clock.get_drift() << endl;
+
     ss << "# Number of smaps Captures Performed: "
        << get_num_smaps_captures() << endl;
 
+    ss << "# Number of statm Probes Performed: "
+       << get_num_statm_probes() << endl;
+
+    ss << "# Number of Shared Caliper Samples: "
+       << get_num_shared_samples() << endl;
+
     ss << "# High Memory Usage Watermark (MPI) (MB): "
        <<  memnesia_util_kb2mb(
                dataset.get_high_mem_usage_watermark_in_kb(memnesia_dataset::MPI)
@@ -195,17 +291,58 @@ memnesia_rt::fill_report_buffer(
        << endl;
 
     ss << "# [Run Info End]" << endl;
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::fill_report_buffer(
+    memnesia_stringstream &ss
+) {
+    fill_run_info(ss);
+    // Node leaders report the footprint of their node.
+    if (0 == node_rank && node_footprint.merged()) {
+        ss << "# Node Footprint (MB):"
+           << endl
+           << "# Format:"
+           << endl
+           << "# KEY Hostname Ranks PssSum Private SharedOnce AnonSharedPss"
+           << " Total MPI MPIHighWatermarkSum"
+           << endl;
+        node_footprint.report(ss, hostname);
+        if (node_footprint.grid_enabled()) {
+            ss << "# Node Footprint (MB) Over Time (Since MPI_Init):"
+               << endl
+               << "# Format:"
+               << endl
+               << "# KEY Time Ranks PssSum Private MPI"
+               << endl;
+            node_footprint.report_grid(ss, node_grid);
+        }
+    }
+    // Unselected ranks only report a summary of their final footprint.
+    if (!selected) {
+        int64_t rss_in_kb = 0;
+        (void)memnesia_statm_sampler::get_rss_in_kb(rss_in_kb);
+        ss << "# Rank Summary:"
+           << endl
+           << "# Format:"
+           << endl
+           << "# KEY FinalRSS (MB)"
+           << endl;
+        ss << "RANK_SUMMARY " << memnesia_util_kb2mb(rss_in_kb) << endl;
+        return;
+    }
     ////////////////////////////////////////////////////////////////////////////
     ////////////////////////////////////////////////////////////////////////////
-    const double init_time = get_init_begin_time();
-
     ss << "# MPI Library Memory Usage (MB) Over Time (Since MPI_Init):"
        << endl
        << "# Format:"
        << endl
        << "# KEY Function Time Usage"
        << endl;
-    dataset.report(ss, memnesia_dataset::MPI, init_time);
+    dataset.report(ss, memnesia_dataset::MPI, clock);
 
     ss << "# Application Memory Usage (MB) Over Time (Since MPI_Init):"
        << endl
@@ -213,7 +350,98 @@ memnesia_rt::fill_report_buffer(
        << endl
        << "# KEY Function Time Usage"
        << endl;
-    dataset.report(ss, memnesia_dataset::APP, init_time);
+    dataset.report(ss, memnesia_dataset::APP, clock);
+
+    fill_stats(ss);
+}
+
+/**
+ * Statistics that summarize the data collected so far.
+ */
+void
+memnesia_rt::fill_stats(
+    memnesia_stringstream &ss
+) {
+    ss << "# MPI Library Memory Usage (MB) Per Function:"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY Function FirstCalls FirstCallTotal"
+       << " SteadyCalls SteadyTotal SteadyMin SteadyMean SteadyMax"
+       << endl;
+    dataset.report_func_stats(ss);
+
+    ss << "# MPI Function Sampling:"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY Function Calls Sampled Skipped ExtrapolatedTotal (MB)"
+       << endl
+       << "# KEY OverheadBudget ToolTime (s) WallTime (s) FinalStride"
+       << endl;
+    dataset.report_sampling_stats(ss, sampling);
+    ss << "SAMPLING_SUMMARY" << " "
+       << sampling.get_overhead_budget() << " "
+       << sampling.get_tool_time() << " "
+       << memnesia_time() - get_init_begin_time() << " "
+       << sampling.get_stride()
+       << endl;
+
+    ss << "# Memory Usage (MB) Per Phase:"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY Phase Samples AppMin AppMax AppGrowth MPIGrowth MPINet"
+       << endl;
+    dataset.report_phase_stats(ss, phase_names);
+
+    if (heap_sampling ||
+        memnesia_smaps_sampler::MALLINFO2 ==
+        memnesia_smaps_sampler::get_backend()) {
+        ss << "# glibc Heap Change (MB) Per MPI Function:"
+           << endl
+           << "# Format:"
+           << endl
+           << "# KEY Function Calls InUse Free Arena Mmapped"
+           << endl
+           << "# KEY InUse Free Arena Mmapped TopPad (at the last sample)"
+           << endl;
+        dataset.report_heap_stats(ss);
+    }
+
+    if (count_call_faults) {
+        ss << "# Page Faults Per MPI Function:"
+           << endl
+           << "# Format:"
+           << endl
+           << "# KEY Function Calls Faults MinorFaults MajorFaults"
+           << endl;
+        for (int fid = 0; fid < MEMNESIA_FID_LAST; ++fid) {
+            const auto &fs = func_faults[fid];
+            if (0 == fs.calls) continue;
+            ss << "MPI_FUNC_FAULTS" << " "
+               << memnesia_func_names[fid] << " "
+               << fs.calls << " "
+               << fs.faults << " "
+               << fs.minor << " "
+               << fs.major
+               << endl;
+        }
+    }
+
+    numa.report(ss, clock);
+
+    if (!callsites.enabled()) return;
+
+    ss << "# MPI Library Memory Usage (MB) Per Application Call Site:"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY CallSite Function Calls Total Min Max"
+       << endl
+       << "# KEY CallSite Depth Frame"
+       << endl;
+    dataset.report_callsite_stats(ss, callsites);
 }
 
 /**
@@ -222,20 +450,36 @@ memnesia_rt::fill_report_buffer(
 std::string
 memnesia_rt::aggregate_data(void)
 {
-    stringstream ss;
+    memnesia_stringstream ss;
 
     fill_report_buffer(ss);
 
-    const bool root = (rank == 0);
-    int report_len = int(ss.str().length());
+    const memnesia_string buff = ss.str();
+    return gather_to_root(string(buff.data(), buff.size()), tool_comm);
+}
+
+/**
+ * Concatenates (in rank order) every process's buff at rank 0.
+ */
+std::string
+memnesia_rt::gather_to_root(
+    const std::string &buff,
+    MPI_Comm comm
+) {
+    int comm_rank = 0, comm_size = 0;
+    (void)PMPI_Comm_rank(comm, &comm_rank);
+    (void)PMPI_Comm_size(comm, &comm_size);
+
+    const bool root = (comm_rank == 0);
+    int report_len = int(buff.length());
     int *recv_sizes = nullptr;
 
     if (root) {
-        recv_sizes = new int[numpe];
+        recv_sizes = new int[comm_size];
     }
 
     if (MPI_SUCCESS != PMPI_Gather(
-        &report_len, 1, MPI_INT, recv_sizes, 1, MPI_INT, 0, MPI_COMM_WORLD
+        &report_len, 1, MPI_INT, recv_sizes, 1, MPI_INT, 0, comm
     )) {
         perror("PMPI_Gather");
         memnesia_exit_failure();
@@ -245,12 +489,12 @@ memnesia_rt::aggregate_data(void)
     int full_report_len = 0;
     char *node_report_buff = nullptr;
     if (root) {
-        displs = new int[numpe];
+        displs = new int[comm_size];
 
         full_report_len += recv_sizes[0];
         displs[0] = 0;
 
-        for (int i = 1; i < numpe; ++i) {
+        for (int i = 1; i < comm_size; ++i) {
             full_report_len += recv_sizes[i];
             displs[i] = displs[i - 1] + recv_sizes[i - 1];
         }
@@ -258,9 +502,8 @@ memnesia_rt::aggregate_data(void)
         node_report_buff = new char[full_report_len];
     }
     //
-    string my_report_buff = ss.str();
     if (MPI_SUCCESS != PMPI_Gatherv(
-        my_report_buff.c_str(),
+        buff.c_str(),
         report_len,
         MPI_CHAR,
         node_report_buff,
@@ -268,7 +511,7 @@ memnesia_rt::aggregate_data(void)
         displs,
         MPI_CHAR,
         0,
-        MPI_COMM_WORLD
+        comm
     )) {
         perror("PMPI_Gatherv");
         memnesia_exit_failure();
@@ -286,13 +529,234 @@ memnesia_rt::aggregate_data(void)
     return node_report;
 }
 
+/**
+ * Parses a rank list, e.g., "0,5,9-12".
+ */
+static bool
+rank_in_list(
+    const std::string &list,
+    int rank
+) {
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+        if (range.empty()) continue;
+        const size_t dash = range.find('-');
+        const int lo = atoi(range.substr(0, dash).c_str());
+        const int hi = (dash == string::npos) ?
+                       lo : atoi(range.substr(dash + 1).c_str());
+        if (rank >= lo && rank <= hi) return true;
+    }
+    return false;
+}
+
+/**
+ * Decides whether or not this rank is instrumented based on MEMNESIA_RANKS:
+ * all (the default), node (one rank per node), every=K (every Kth rank),
+ * list=RANKS (e.g., list=0,5,9-12), or random=FRACTION[:SEED] (a seeded
+ * random sample). The decision is made locally, so no communication is
+ * needed.
+ */
+void
+memnesia_rt::select_ranks(void)
+{
+    const char *ranks = getenv(MEMNESIA_ENV_RANKS);
+    if (!ranks) return;
+
+    const string spec(ranks);
+    const size_t eq = spec.find('=');
+    const string mode = spec.substr(0, eq);
+    const string arg = (eq == string::npos) ? "" : spec.substr(eq + 1);
+
+    if (mode == "all") {
+        selected = true;
+    }
+    else if (mode == "node") {
+        selected = (0 == node_rank);
+    }
+    else if (mode == "every" && atoi(arg.c_str()) > 0) {
+        selected = (0 == rank % atoi(arg.c_str()));
+    }
+    else if (mode == "list") {
+        selected = rank_in_list(arg, rank);
+    }
+    else if (mode == "random") {
+        const size_t colon = arg.find(':');
+        const double fraction = atof(arg.substr(0, colon).c_str());
+        const uint64_t seed = (colon == string::npos) ?
+            0 : strtoull(arg.substr(colon + 1).c_str(), nullptr, 10);
+        // splitmix64 of the seeded rank, mapped to [0, 1).
+        uint64_t z = seed + uint64_t(rank) * 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        z = z ^ (z >> 31);
+        selected = (double(z >> 11) / double(uint64_t(1) << 53)) < fraction;
+    }
+    else if (rank == 0) {
+        fprintf(
+            stderr,
+            "# memnesia: ignoring invalid %s '%s'.\n",
+            MEMNESIA_ENV_RANKS, ranks
+        );
+    }
+
+    if (selected) return;
+    // Unselected ranks run pure pass-through wrappers from here on.
+    for (int fid = 0; fid < MEMNESIA_FID_LAST; ++fid) {
+        memnesia_func_skipped[fid] = true;
+    }
+    instrumenting = false;
+}
+
+/**
+ * Sets up the node's telemetry segment, named after the node leader's PID. All
+ * ranks on a node attach, even uninstrumented ones, so monitors see the whole
+ * node. Failures only disable telemetry.
+ */
+void
+memnesia_rt::set_telemetry(void)
+{
+    const char *tel = getenv(MEMNESIA_ENV_TELEMETRY);
+    if (!tel || 0 == strcmp(tel, "0")) return;
+
+    int leader_pid = int(getpid()), node_size = 0;
+    (void)PMPI_Bcast(&leader_pid, 1, MPI_INT, 0, node_comm);
+    (void)PMPI_Comm_size(node_comm, &node_size);
+
+    const string name = "/" MEMNESIA_TELEMETRY_PREFIX + to_string(leader_pid);
+    int created = 1;
+    if (0 == node_rank) {
+        created = telemetry.create(
+            name, node_size, numpe, get_hostname().c_str(),
+            get_app_name().c_str()
+        ) ? 1 : 0;
+    }
+    (void)PMPI_Bcast(&created, 1, MPI_INT, 0, node_comm);
+    if (!created) return;
+
+    if (!telemetry.attach(name, node_rank, rank, selected)) return;
+
+    if (0 == node_rank) {
+        printf("# memnesia telemetry: /dev/shm%s\n", name.c_str());
+    }
+}
+
+/**
+ * Opens this rank's sample log, a ring of MEMNESIA_LOG_RECORDS records kept
+ * next to the report.
+ */
+void
+memnesia_rt::set_log(void)
+{
+    const char *nrecords = getenv(MEMNESIA_ENV_LOG_RECORDS);
+    if (!nrecords || !selected) return;
+
+    const long long capacity = atoll(nrecords);
+    if (capacity <= 0) return;
+
+    const string path = get_report_path("rank" + to_string(rank) + ".mlog");
+    if (!log.open(
+            path, uint64_t(capacity), rank, numpe, get_init_begin_time(),
+            get_date_time_str_now(), get_hostname(), get_app_name()
+        )) {
+        fprintf(stderr, "# memnesia: could not open sample log %s.\n",
+                path.c_str());
+    }
+}
+
+/**
+ * With MEMNESIA_SNAPSHOT_DIR set, SIGUSR2 asks for a snapshot of this rank's
+ * statistics. The handler only sets a flag; the next caliper does the work.
+ */
+void
+memnesia_rt::set_snapshot_handler(void)
+{
+    const char *dir = getenv(MEMNESIA_ENV_SNAPSHOT_DIR);
+    if (!dir || !selected) return;
+
+    snapshot_dir = dir;
+
+    struct sigaction sa;
+    (void)memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = snapshot_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    (void)sigemptyset(&sa.sa_mask);
+    (void)sigaction(SIGUSR2, &sa, &old_sigusr2_action);
+}
+
+/**
+ * Writes a compact snapshot of this rank's current usage and statistics (no
+ * timelines) to the snapshot directory. No communication is involved, and
+ * nothing is allocated outside of the tool's arena.
+ */
+void
+memnesia_rt::write_snapshot(
+    const memnesia_sample &latest
+) {
+    snapshot_requested.store(false, std::memory_order_relaxed);
+
+    const double start = memnesia_time();
+
+    memnesia_stringstream ss;
+    fill_run_info(ss);
+    ss << "# Snapshot:"
+       << endl
+       << "# Format:"
+       << endl
+       << "# KEY Snapshot Time APPUsage (MB) MPIUsage (MB)"
+       << endl;
+    ss << "SNAPSHOT " << num_snapshots << " "
+       << clock.since_origin(start) << " "
+       << memnesia_util_kb2mb(latest.get_mem_usage_in_kb()) << " "
+       << memnesia_util_kb2mb(mpi_usage_in_kb)
+       << endl;
+    fill_stats(ss);
+
+    char name[PATH_MAX];
+    (void)snprintf(
+        name, sizeof(name), "%s/%s.rank%d.snap%d.memnesia",
+        snapshot_dir.c_str(), get_app_name().c_str(), rank, num_snapshots
+    );
+    num_snapshots++;
+
+    FILE *snapf = fopen(name, "w");
+    if (!snapf) {
+        fprintf(stderr, "Error saving snapshot to %s.\n", name);
+    }
+    else {
+        fprintf(snapf, "%s", ss.str().c_str());
+        fclose(snapf);
+    }
+
+    sampling.add_tool_time(memnesia_time() - start);
+}
+
+/**
+ *
+ */
+bool
+memnesia_rt::is_selected(void)
+{
+    return selected;
+}
+
 /**
  *
  */
 void
 memnesia_rt::pfini(void)
 {
-    // Nothing to do.
+    log.close();
+    telemetry.close();
+    if (MPI_COMM_NULL != leader_comm) {
+        PMPI_Comm_free(&leader_comm);
+    }
+    if (MPI_COMM_NULL != node_comm) {
+        PMPI_Comm_free(&node_comm);
+    }
+    if (MPI_COMM_NULL != tool_comm) {
+        PMPI_Comm_free(&tool_comm);
+    }
 }
 
 /**
@@ -337,120 +801,577 @@ memnesia_rt::sample(
     const std::string &what,
     memnesia_sample &res
 ) {
-    res = memnesia_sample(what);
+    const double start = memnesia_time();
+    // Two-tier sampling: only parse smaps if statm says RSS has changed enough
+    // since the last full parse. Otherwise, reuse the last full parse's values.
+    int64_t rss_in_kb = -1;
+    if (statm_gate_in_kb >= 0) {
+        num_statm_probes++;
+        if (!memnesia_statm_sampler::get_rss_in_kb(rss_in_kb)) {
+            rss_in_kb = -1;
+        }
+    }
+    last_rss_in_kb = rss_in_kb;
+    // Likewise with page faults: no faults, no new pages.
+    int64_t nfaults = -1;
+    memnesia_fault_counters::counts fc;
+    if (fault_gate >= 0 && faults.read(fc)) {
+        nfaults = int64_t(fc.faults);
+    }
+
+    const bool gated = (statm_gate_in_kb >= 0 || fault_gate >= 0);
+    const bool statm_quiet = rss_in_kb >= 0 && last_full_rss_in_kb >= 0 &&
+        llabs(rss_in_kb - last_full_rss_in_kb) <= statm_gate_in_kb;
+    const bool faults_quiet = nfaults >= 0 && last_full_faults >= 0 &&
+        nfaults - last_full_faults <= fault_gate;
+
+    if (gated && (statm_gate_in_kb < 0 || statm_quiet) &&
+        (fault_gate < 0 || faults_quiet)) {
+        res = memnesia_sample(what, last_full_sample.get_smaps());
+    }
+    else {
+        num_smaps_parses++;
+        res = memnesia_sample(what);
+        if (gated) {
+            last_full_sample = res;
+            last_full_rss_in_kb = rss_in_kb;
+            last_full_faults = nfaults;
+        }
+    }
+    // Cheap, so always current, even when smaps values are reused.
+    if (heap_sampling) res.sample_heap();
+    res.set_phase(phase);
+
+    sampling.add_tool_time(memnesia_time() - start);
 }
 
 /**
- *
+ * Takes a caliper's "before" sample. When the previous caliper's "after"
+ * sample was taken less than share_gap seconds ago, application memory usage
+ * is assumed not to have changed in between (checked with a statm probe when
+ * two-tier sampling is enabled), so that sample is reused instead.
  */
 void
-memnesia_rt::sample_delta(
-    const memnesia_sample &happened_before,
-    const memnesia_sample &happened_after,
-    memnesia_sample &delta
+memnesia_rt::sample_before(
+    const std::string &what,
+    memnesia_sample &res
 ) {
-    memnesia_sample::delta(happened_before, happened_after, delta);
-}
+    if (numa.per_call()) numa.begin_call();
 
-/**
- *
- */
-std::string
-memnesia_rt::get_output_path(void)
-{
-    //
-    char *output_dir = getenv(MEMNESIA_ENV_REPORT_OUTPUT_PATH);
-    // Not set, so output to pwd.
-    if (!output_dir) {
-        output_dir = getenv("PWD");
+    if (share_gap < 0.0 || !have_last_after_sample) {
+        sample(what, res);
+        return;
     }
-    if (!output_dir) {
-        fprintf(stderr, "Error saving report.\n");
-        memnesia_exit_failure();
+
+    const double start = memnesia_time();
+    bool share = (start - last_after_time < share_gap);
+
+    if (share && statm_gate_in_kb >= 0 && last_after_rss_in_kb >= 0) {
+        num_statm_probes++;
+        int64_t rss_in_kb = -1;
+        share = memnesia_statm_sampler::get_rss_in_kb(rss_in_kb) &&
+                llabs(rss_in_kb - last_after_rss_in_kb) <= statm_gate_in_kb;
+    }
+
+    if (!share) {
+        sampling.add_tool_time(memnesia_time() - start);
+        sample(what, res);
+        return;
     }
 
-    return std::string(output_dir);
+    num_shared_samples++;
+    res = memnesia_sample(what, last_after_sample.get_smaps());
+    if (heap_sampling) res.sample_heap();
+    res.set_phase(phase);
+
+    sampling.add_tool_time(memnesia_time() - start);
 }
 
 /**
- *
+ * Takes a caliper's "after" sample and remembers it for sample_before.
  */
 void
-memnesia_rt::sample_emit(
-    const memnesia_sample &s
+memnesia_rt::sample_after(
+    const std::string &what,
+    memnesia_sample &res
 ) {
-    memnesia_sample::emit(s);
+    if (numa.per_call()) numa.end_call(what);
+
+    sample(what, res);
+
+    if (share_gap < 0.0) return;
+
+    last_after_sample = res;
+    last_after_time = memnesia_time();
+    last_after_rss_in_kb = last_rss_in_kb;
+    have_last_after_sample = true;
 }
 
 /**
  *
  */
 void
-memnesia_rt::add_samples_to_dataset(
-    const memnesia_sample &happened_before,
-    const memnesia_sample &happened_after
-) {
-    memnesia_sample delta;
+memnesia_rt::set_share_gap(void)
+{
+    const char *gap = getenv(MEMNESIA_ENV_SHARE_GAP);
+    if (!gap) return;
 
-    memnesia_rt::sample_delta(happened_before, happened_after, delta);
+    share_gap = atof(gap);
+    if (share_gap < 0.0) share_gap = -1.0;
+}
 
-    dataset.push_back(memnesia_dataset::APP, happened_before);
-    dataset.push_back(memnesia_dataset::APP, happened_after);
+/**
+ * Selects the sampler backend named by MEMNESIA_SAMPLER (smaps by default).
+ */
+void
+memnesia_rt::set_sampler_backend(void)
+{
+    const char *backend = getenv(MEMNESIA_ENV_SAMPLER);
+    if (!backend) return;
 
-    dataset.push_back(memnesia_dataset::MPI, delta);
+    if (!memnesia_smaps_sampler::set_backend(backend)) {
+        fprintf(
+            stderr,
+            "# memnesia: %s '%s' unknown or unavailable, using '%s'.\n",
+            MEMNESIA_ENV_SAMPLER, backend,
+            memnesia_smaps_sampler::get_backend_name()
+        );
+    }
 }
 
 /**
- *
+ * Only glibc's allocator is looked at.
  */
-int64_t
-memnesia_rt::get_num_smaps_captures(void)
+void
+memnesia_rt::set_heap_sampling(void)
 {
-    return dataset.length(memnesia_dataset::APP);
+    const char *heap = getenv(MEMNESIA_ENV_HEAP);
+    if (heap) heap_sampling = (0 != atoi(heap));
+    // That backend fills the heap entries anyway.
+    if (memnesia_smaps_sampler::MALLINFO2 ==
+        memnesia_smaps_sampler::get_backend()) {
+        heap_sampling = false;
+    }
 }
 
 /**
- *
+ * The counters follow the thread that first enters the tool, i.e., the one
+ * calling MPI_Init.
  */
 void
-memnesia_rt::report(void)
+memnesia_rt::set_fault_counters(void)
 {
-    //
-    if (rank == 0) {
-        printf(
-            "\n"
-            "\n#"
-            "\n# memnesia memory consumption analysis complete..."
-            "\n#"
-            "\n"
+    const char *count = getenv(MEMNESIA_ENV_FAULTS);
+    count_call_faults = count && 0 != atoi(count);
+    const char *gate = getenv(MEMNESIA_ENV_FAULT_GATE);
+    if (gate) fault_gate = atoll(gate);
+    if (fault_gate < 0) fault_gate = -1;
+
+    if (!count_call_faults && fault_gate < 0) return;
+
+    if (!faults.open()) {
+        fprintf(
+            stderr, "# memnesia: page-fault counters unavailable "
+            "(see /proc/sys/kernel/perf_event_paranoid), "
+            "ignoring %s and %s.\n",
+            MEMNESIA_ENV_FAULTS, MEMNESIA_ENV_FAULT_GATE
         );
+        count_call_faults = false;
+        fault_gate = -1;
     }
-    //
-    string node_report = aggregate_data();
-    // Only one MPI process will write the report.
-    if (rank != 0) return;
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::end_call_faults(memnesia_func_id fid)
+{
+    if (!have_call_faults_before) return;
+    have_call_faults_before = false;
+
+    memnesia_fault_counters::counts after;
+    if (!faults.read(after)) return;
+
+    auto &fs = func_faults[fid];
+    fs.calls++;
+    fs.faults += after.faults - call_faults_before.faults;
+    fs.minor += after.minor - call_faults_before.minor;
+    fs.major += after.major - call_faults_before.major;
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::set_statm_gate(void)
+{
+    const char *gate = getenv(MEMNESIA_ENV_STATM_GATE);
+    if (!gate) return;
 
-    std::string output_dir = get_output_path();
-    std::string s_output_name = get_app_name() + "-"
-                              + get_date_time_str_now();
-    char *output_name = getenv(MEMNESIA_ENV_REPORT_NAME);
-    if (output_name) {
-        s_output_name = std::string(output_name);
+    statm_gate_in_kb = atoll(gate);
+    if (statm_gate_in_kb < 0) statm_gate_in_kb = -1;
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::set_instrumentation_enabled(bool enabled)
+{
+    // Unselected ranks stay uninstrumented regardless.
+    instrumenting = enabled && selected;
+}
+
+/**
+ * Returns label in a form that can be used as a single report field.
+ */
+static std::string
+sanitize_label(const char *label)
+{
+    std::string res(label ? label : "");
+    for (auto &c : res) {
+        if (isspace(c)) c = '_';
+    }
+    return res.empty() ? std::string("unnamed") : res;
+}
+
+/**
+ * Makes label the current application phase. Subsequent samples are
+ * attributed to it until the next phase is marked.
+ */
+void
+memnesia_rt::mark_phase(const char *label)
+{
+    if (!selected) return;
+
+    const std::string name = sanitize_label(label);
+
+    uint32_t id = 0;
+    for (; id < phase_names.size(); ++id) {
+        if (phase_names[id] == name.c_str()) break;
+    }
+    if (id == phase_names.size()) {
+        phase_names.push_back(memnesia_string(name.c_str()));
+    }
+    // Capture the phase boundary once, closing out the previous phase and
+    // giving the new phase a starting point.
+    if (!instrumenting) {
+        phase = id;
+        return;
     }
+    numa.take_snapshot("phase:" + name, memnesia_time());
+
+    memnesia_sample boundary;
+    sample(MEMNESIA_MARK_FUNC, boundary);
+    dataset.push_back(memnesia_dataset::APP, boundary);
+
+    phase = id;
+    boundary.set_phase(phase);
+    dataset.push_back(memnesia_dataset::APP, boundary);
+}
+
+/**
+ * Captures an application memory usage sample outside of any MPI call.
+ */
+void
+memnesia_rt::sample_now(const char *label)
+{
+    if (!selected) return;
+
+    memnesia_sample now;
+    sample(sanitize_label(label), now);
+    dataset.push_back(memnesia_dataset::APP, now);
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::sample_delta(
+    const memnesia_sample &happened_before,
+    const memnesia_sample &happened_after,
+    memnesia_sample &delta
+) {
+    memnesia_sample::delta(happened_before, happened_after, delta);
+}
+
+/**
+ *
+ */
+const char *
+memnesia_rt::get_output_path(void)
+{
     //
+    char *output_dir = getenv(MEMNESIA_ENV_REPORT_OUTPUT_PATH);
+    // Not set, so output to pwd.
+    if (!output_dir) {
+        output_dir = getenv("PWD");
+    }
+    if (!output_dir) {
+        fprintf(stderr, "Error saving report.\n");
+        memnesia_exit_failure();
+    }
+
+    return output_dir;
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::sample_emit(
+    const memnesia_sample &s
+) {
+    memnesia_sample::emit(s);
+}
+
+/**
+ * Returns a key that identifies the given communicator. Communicators are
+ * keyed by their Fortran handles so that handle types that are not ordered
+ * (e.g., pointers in some implementations) can still be stored in a set.
+ */
+MPI_Fint
+memnesia_rt::comm_key(MPI_Comm comm)
+{
+    // Don't call into MPI for functions not associated with a communicator,
+    // since they may be called before MPI has been initialized.
+    if (MPI_COMM_NULL == comm) return MPI_Fint(-1);
+    return PMPI_Comm_c2f(comm);
+}
+
+/**
+ * Returns whether or not this is the first time the given function has been
+ * called on comm.
+ */
+bool
+memnesia_rt::first_contact(
+    memnesia_func_id fid,
+    MPI_Comm comm
+) {
+    return contacted.insert(make_pair(fid, comm_key(comm))).second;
+}
+
+/**
+ * Forgets all first contacts on comm, since its handle may be reused by a
+ * communicator created after comm is freed.
+ */
+void
+memnesia_rt::forget_comm(MPI_Comm comm)
+{
+    if (MPI_COMM_NULL == comm) return;
+
+    const MPI_Fint key = comm_key(comm);
+    for (auto it = contacted.begin(); it != contacted.end(); ) {
+        if (it->second == key) {
+            it = contacted.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::add_samples_to_dataset(
+    const memnesia_sample &happened_before,
+    const memnesia_sample &happened_after,
+    bool first_call,
+    int32_t callsite,
+    int64_t msg_bytes,
+    int32_t peer
+) {
+    memnesia_sample delta;
+
+    memnesia_rt::sample_delta(happened_before, happened_after, delta);
+    delta.set_first_call(first_call);
+    delta.set_callsite(callsite);
+    delta.set_message(msg_bytes, peer);
+
+    dataset.push_back(memnesia_dataset::APP, happened_before);
+    dataset.push_back(memnesia_dataset::APP, happened_after);
+
+    dataset.push_back(memnesia_dataset::MPI, delta);
+
+    mpi_usage_in_kb += delta.get_mem_usage_in_kb();
+    publish_telemetry(happened_after, "");
+    if (log.enabled()) {
+        log.append(
+            clock.since_origin(happened_after.get_capture_time()),
+            happened_after.get_target_func_name(),
+            happened_after.get_mem_usage_in_kb(),
+            delta.get_mem_usage_in_kb(),
+            mpi_usage_in_kb,
+            delta.get_phase(),
+            first_call
+        );
+    }
+    if (watchdog.is_started()) {
+        check_watchdog(happened_after, callsite);
+    }
+    if (snapshot_requested.load(std::memory_order_relaxed)) {
+        write_snapshot(happened_after);
+    }
+    if (heat.enabled()) {
+        heat.add(
+            clock.since_origin(happened_after.get_capture_time()),
+            memnesia_util_kb2mb(happened_after.get_mem_usage_in_kb()),
+            memnesia_util_kb2mb(mpi_usage_in_kb)
+        );
+    }
+    if (node_footprint.grid_enabled()) {
+        const auto &smaps = happened_after.get_smaps();
+        memnesia_node_footprint::grid_point point;
+        point.nranks = 1;
+        point.pss_in_kb = happened_after.get_mem_usage_in_kb();
+        point.private_in_kb =
+            smaps.data_in_kb[memnesia_smaps_sampler::PRIVATE_CLEAN] +
+            smaps.data_in_kb[memnesia_smaps_sampler::PRIVATE_DIRTY];
+        point.mpi_in_kb = mpi_usage_in_kb;
+        node_footprint.add_grid_point(
+            clock.since_origin(happened_after.get_capture_time()), point
+        );
+    }
+}
+
+/**
+ *
+ */
+int64_t
+memnesia_rt::get_num_smaps_captures(void)
+{
+    return num_smaps_parses;
+}
+
+/**
+ *
+ */
+int64_t
+memnesia_rt::get_num_statm_probes(void)
+{
+    return num_statm_probes;
+}
+
+/**
+ *
+ */
+int64_t
+memnesia_rt::get_num_shared_samples(void)
+{
+    return num_shared_samples;
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::set_report_formats(void)
+{
+    const char *formats = getenv(MEMNESIA_ENV_REPORT_FORMATS);
+    if (!formats) {
+        formats = MEMNESIA_REPORT_FORMAT_MEMNESIA;
+    }
+
+    stringstream ss(formats);
+    string format;
+    while (getline(ss, format, ',')) {
+        if (format.empty()) continue;
+        if (format != MEMNESIA_REPORT_FORMAT_MEMNESIA &&
+            format != MEMNESIA_REPORT_FORMAT_PPROF &&
+            format != MEMNESIA_REPORT_FORMAT_FOLDED &&
+            format != MEMNESIA_REPORT_FORMAT_CHROME) {
+            if (rank == 0) {
+                fprintf(
+                    stderr,
+                    "# memnesia: ignoring unknown report format '%s'.\n",
+                    format.c_str()
+                );
+            }
+            continue;
+        }
+        report_formats.insert(memnesia_string(format.data(), format.size()));
+    }
+}
+
+/**
+ *
+ */
+bool
+memnesia_rt::report_format_enabled(
+    const std::string &format
+) {
+    return report_formats.count(
+        memnesia_string(format.data(), format.size())
+    ) != 0;
+}
+
+/**
+ * Every rank names its files after rank 0's report, whose default name
+ * includes rank 0's clock time, so that the files of a run share a prefix.
+ */
+void
+memnesia_rt::set_report_base_name(void)
+{
+    if (0 == rank) {
+        report_base_name = get_app_name() + "-" + get_date_time_str_now();
+        char *output_name = getenv(MEMNESIA_ENV_REPORT_NAME);
+        if (output_name) {
+            report_base_name = std::string(output_name);
+        }
+    }
+    int len = int(report_base_name.size());
+    if (MPI_SUCCESS != PMPI_Bcast(&len, 1, MPI_INT, 0, tool_comm)) {
+        perror("PMPI_Bcast");
+        memnesia_exit_failure();
+    }
+    report_base_name.resize(size_t(len));
+    if (MPI_SUCCESS != PMPI_Bcast(
+        &report_base_name[0], len, MPI_CHAR, 0, tool_comm
+    )) {
+        perror("PMPI_Bcast");
+        memnesia_exit_failure();
+    }
+}
+
+/**
+ * Returns the path of the report file with the given extension. Valid once
+ * set_report_base_name() has been called.
+ */
+std::string
+memnesia_rt::get_report_path(
+    const std::string &ext
+) {
     char report_name[PATH_MAX];
     snprintf(
         report_name,
         sizeof(report_name) - 1,
         "%s/%s.%s",
-        output_dir.c_str(),
-        s_output_name.c_str(),
-        "memnesia"
+        get_output_path(),
+        report_base_name.c_str(),
+        ext.c_str()
     );
 
-    FILE *reportf = fopen(report_name, "w+");
+    return std::string(report_name);
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::write_report(void)
+{
+    string node_report = aggregate_data();
+    // Only one MPI process will write the report.
+    if (rank != 0) return;
+
+    const string report_name = get_report_path("memnesia");
+
+    FILE *reportf = fopen(report_name.c_str(), "w+");
     if (!reportf) {
-        fprintf(stderr, "Error saving report to %s.\n", report_name);
+        fprintf(stderr, "Error saving report to %s.\n", report_name.c_str());
         return;
     }
 
@@ -458,10 +1379,391 @@ memnesia_rt::report(void)
 
     fclose(reportf);
 
+    printf("# Report written to %s\n", report_name.c_str());
+}
+
+/**
+ * Writes a Trace Event Format JSON file per node, one process (track group)
+ * per rank, so that large runs stay loadable in trace viewers. Node leaders
+ * write their node's file, named after their rank.
+ */
+void
+memnesia_rt::write_trace_events(void)
+{
+    memnesia_stringstream ss;
+    ss << ",\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << rank
+       << ",\"args\":{\"name\":\"Rank " << rank << " ("
+       << hostname << ")\"}}"
+       << ",\n{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":"
+       << rank << ",\"args\":{\"sort_index\":" << rank << "}}";
+    dataset.report_trace_events(ss, rank, clock);
+
+    const memnesia_string buff = ss.str();
+    const string all = gather_to_root(
+        string(buff.data(), buff.size()), node_comm
+    );
+    if (MPI_COMM_NULL == leader_comm) return;
+    const string path = get_report_path("node" + to_string(rank) + ".json");
+    FILE *tracef = fopen(path.c_str(), "w+");
+    if (!tracef) {
+        fprintf(stderr, "Error saving trace to %s.\n", path.c_str());
+        return;
+    }
+    // Drop the first event's leading comma.
+    fprintf(
+        tracef, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[%s\n]}\n",
+        all.empty() ? "" : all.c_str() + 1
+    );
+    fclose(tracef);
+
+    if (0 == rank) {
+        printf(
+            "# Trace events written to %snode*.json\n",
+            get_report_path("").c_str()
+        );
+    }
+}
+
+/**
+ * Ranks agree on the widest bucket span, then rank 0 gathers one fixed-size
+ * row per rank, so the cost depends on the number of buckets, not on the
+ * length of the run.
+ */
+void
+memnesia_rt::write_heat_matrix(void)
+{
+    if (!heat.enabled()) return;
+
+    double local_span = heat.get_span(), span = 0.0;
+    if (MPI_SUCCESS != PMPI_Allreduce(
+        &local_span, &span, 1, MPI_DOUBLE, MPI_MAX, tool_comm
+    )) {
+        perror("PMPI_Allreduce");
+        memnesia_exit_failure();
+    }
+    heat.coarsen_to(span);
+
+    const size_t nbuckets = heat.get_num_buckets();
+    const size_t row_len = nbuckets * memnesia_heat::row_stride;
+    memnesia_vector<double> row(row_len), rows;
+    heat.fill_row(row.data());
+    if (0 == rank) rows.resize(size_t(numpe) * row_len);
+    if (MPI_SUCCESS != PMPI_Gather(
+        row.data(), int(row_len), MPI_DOUBLE,
+        rows.data(), int(row_len), MPI_DOUBLE, 0, tool_comm
+    )) {
+        perror("PMPI_Gather");
+        memnesia_exit_failure();
+    }
+    if (0 != rank) return;
+
+    const string path = get_report_path("heat");
+    FILE *heatf = fopen(path.c_str(), "w+");
+    if (!heatf) {
+        fprintf(stderr, "Error saving heat matrix to %s.\n", path.c_str());
+        return;
+    }
+    stringstream ss;
+    memnesia_heat::write_matrix(ss, numpe, nbuckets, span, rows.data());
+    fprintf(heatf, "%s", ss.str().c_str());
+    fclose(heatf);
+
+    printf("# Heat matrix written to %s\n", path.c_str());
+}
+
+/**
+ * Merges every process's MPI memory growth per call stack at rank 0 and writes
+ * it out in the requested profile formats.
+ */
+void
+memnesia_rt::write_profiles(void)
+{
+    memnesia_profile profile;
+    dataset.fill_profile(profile, callsites);
+
+    const string all_profiles = gather_to_root(profile.serialize(), tool_comm);
+    // Only one MPI process will write the profiles.
+    if (rank != 0) return;
+
+    memnesia_profile merged;
+    merged.merge_serialized(all_profiles);
+
+    if (report_format_enabled(MEMNESIA_REPORT_FORMAT_PPROF)) {
+        const string path = get_report_path("pb");
+        if (merged.write_pprof(path)) {
+            printf("# pprof profile written to %s\n", path.c_str());
+        }
+    }
+    if (report_format_enabled(MEMNESIA_REPORT_FORMAT_FOLDED)) {
+        const string path = get_report_path("folded");
+        if (merged.write_folded(path)) {
+            printf("# Folded stacks written to %s\n", path.c_str());
+        }
+    }
+}
+
+/**
+ * Logs the first crossing of each watchdog threshold along with the function,
+ * call site, and the mappings that grew the most since MPI_Init. Then, as
+ * configured, writes this rank's partial report and/or aborts the job.
+ */
+void
+memnesia_rt::check_watchdog(
+    const memnesia_sample &happened_after,
+    int32_t callsite
+) {
+    const double start = memnesia_time();
+    int64_t usage_in_kb = 0;
+    const auto lid = watchdog.check(
+        happened_after.get_mem_usage_in_kb(), mpi_usage_in_kb,
+        start, usage_in_kb
+    );
+    if (memnesia_watchdog::LAST == lid) {
+        sampling.add_tool_time(memnesia_time() - start);
+        return;
+    }
+
+    memnesia_stringstream ss;
+    ss << "# memnesia watchdog: rank " << rank << " on " << hostname
+       << ": " << memnesia_watchdog::limit_name(lid) << " usage "
+       << memnesia_util_kb2mb(usage_in_kb) << " MB exceeds "
+       << memnesia_util_kb2mb(watchdog.get_limit_in_kb(lid)) << " MB in "
+       << happened_after.get_target_func_name() << " at "
+       << clock.since_origin(happened_after.get_capture_time())
+       << " s" << endl;
+    if (callsite != memnesia_callsite_table::no_callsite) {
+        ss << "#   call site:" << endl;
+        for (const auto pc : callsites.get_stack(callsite)) {
+            ss << "#     " << memnesia_callsite_table::symbolize(pc) << endl;
+        }
+    }
+    memnesia_stringstream top(watchdog.top_growing_mappings(5));
+    memnesia_string line;
+    ss << "#   top growing mappings since MPI_Init:" << endl;
+    while (getline(top, line)) {
+        ss << "#     " << line << endl;
+    }
+    fprintf(stderr, "%s", ss.str().c_str());
+
+    if (watchdog.get_actions() & memnesia_watchdog::FLUSH) {
+        write_partial_report();
+    }
+    if (watchdog.get_actions() & memnesia_watchdog::ABORT) {
+        seal_log(MEMNESIA_LOG_ABORTED);
+        PMPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    sampling.add_tool_time(memnesia_time() - start);
+}
+
+/**
+ * Writes this rank's report on its own, without any communication, e.g., when
+ * the job might not make it to MPI_Finalize. Nothing is allocated outside of
+ * the tool's arena.
+ */
+void
+memnesia_rt::write_partial_report(void)
+{
+    memnesia_stringstream ss;
+    fill_report_buffer(ss);
+
+    char report_name[PATH_MAX];
+    (void)snprintf(
+        report_name, sizeof(report_name), "%s/%s.rank%d.partial.memnesia",
+        get_output_path(), report_base_name.c_str(), rank
+    );
+    FILE *reportf = fopen(report_name, "w+");
+    if (!reportf) {
+        fprintf(stderr, "Error saving report to %s.\n", report_name);
+        return;
+    }
+    fprintf(reportf, "%s", ss.str().c_str());
+    fclose(reportf);
+
+    fprintf(stderr, "# Partial report written to %s\n", report_name);
+}
+
+/**
+ * Estimates the offset between the local clock and rank 0's clock. Only node
+ * leaders ping-pong with rank 0, one after the other, since memnesia_time() is
+ * node-wide; the round trip with the smallest latency wins. Leaders then share
+ * their estimate with the rest of their node.
+ */
+void
+memnesia_rt::measure_clock_offset(
+    double &at_local_time,
+    double &local_minus_root
+) {
+    static const int npings = 8;
+    static const int tag = 0x6d6e;
+
+    at_local_time = memnesia_time();
+    local_minus_root = 0.0;
+
+    if (MPI_COMM_NULL != leader_comm) {
+        int leader_rank = 0, nleaders = 0;
+        (void)PMPI_Comm_rank(leader_comm, &leader_rank);
+        (void)PMPI_Comm_size(leader_comm, &nleaders);
+
+        if (0 == leader_rank) {
+            for (int l = 1; l < nleaders; ++l) {
+                for (int p = 0; p < npings; ++p) {
+                    double ping = 0.0;
+                    (void)PMPI_Recv(
+                        &ping, 1, MPI_DOUBLE, l, tag, leader_comm,
+                        MPI_STATUS_IGNORE
+                    );
+                    const double now = memnesia_time();
+                    (void)PMPI_Send(&now, 1, MPI_DOUBLE, l, tag, leader_comm);
+                }
+            }
+        }
+        else {
+            double best_rtt = -1.0;
+            for (int p = 0; p < npings; ++p) {
+                const double t0 = memnesia_time();
+                double root_time = 0.0;
+                (void)PMPI_Send(&t0, 1, MPI_DOUBLE, 0, tag, leader_comm);
+                (void)PMPI_Recv(
+                    &root_time, 1, MPI_DOUBLE, 0, tag, leader_comm,
+                    MPI_STATUS_IGNORE
+                );
+                const double t1 = memnesia_time();
+                if (best_rtt < 0.0 || t1 - t0 < best_rtt) {
+                    best_rtt = t1 - t0;
+                    at_local_time = (t0 + t1) / 2.0;
+                    local_minus_root = at_local_time - root_time;
+                }
+            }
+        }
+    }
+
+    double est[2] = {at_local_time, local_minus_root};
+    (void)PMPI_Bcast(est, 2, MPI_DOUBLE, 0, node_comm);
+    at_local_time = est[0];
+    local_minus_root = est[1];
+}
+
+/**
+ * At init, measures the clock offset and adopts rank 0's MPI_Init time as the
+ * origin of all timelines. At finalize, measures again to estimate drift.
+ */
+void
+memnesia_rt::sync_clocks(bool at_finalize)
+{
+    if (!at_finalize) {
+        const char *sync = getenv(MEMNESIA_ENV_CLOCK_SYNC);
+        clock_sync = !(sync && 0 == strcmp(sync, "0"));
+        clock.set_origin(get_init_begin_time());
+    }
+    if (!clock_sync) return;
+
+    double at_local_time = 0.0, local_minus_root = 0.0;
+    measure_clock_offset(at_local_time, local_minus_root);
+
+    if (!at_finalize) {
+        clock.set_offset(at_local_time, local_minus_root);
+        double root_init_time = get_init_begin_time();
+        (void)PMPI_Bcast(&root_init_time, 1, MPI_DOUBLE, 0, tool_comm);
+        clock.set_origin(root_init_time);
+        return;
+    }
+    // Offset and reference time from init are kept.
+    const double elapsed = at_local_time - clock.get_ref_time();
+    if (elapsed > 0.0) {
+        clock.set_drift((local_minus_root - clock.get_offset()) / elapsed);
+    }
+}
+
+/**
+ * Collective over the node communicator: each rank takes one per-mapping smaps
+ * pass and the node leader merges the results. Grid points, if any, are summed
+ * bin by bin.
+ */
+void
+memnesia_rt::reduce_node_footprint(void)
+{
+    memnesia_footprint_sampler::footprint fp;
+    if (!memnesia_footprint_sampler::get_footprint(fp)) {
+        perror("memnesia_footprint_sampler::get_footprint");
+    }
+    const string local = memnesia_node_footprint::serialize(
+        fp,
+        mpi_usage_in_kb,
+        dataset.get_high_mem_usage_watermark_in_kb(memnesia_dataset::MPI)
+    );
+    const string all = gather_to_root(local, node_comm);
+    if (0 == node_rank) {
+        node_footprint.merge_serialized(all);
+    }
+    //
+    if (!node_footprint.grid_enabled()) return;
+
+    auto &grid = node_footprint.get_grid();
+    // Uninstrumented ranks only sampled MPI_Init, which would stand in for the
+    // whole run.
+    if (!selected) grid.clear();
+    uint64_t local_bins = grid.size(), nbins = 0;
+    if (MPI_SUCCESS != PMPI_Allreduce(
+        &local_bins, &nbins, 1, MPI_UINT64_T, MPI_MAX, node_comm
+    )) {
+        perror("PMPI_Allreduce");
+        memnesia_exit_failure();
+    }
+    node_footprint.pad_grid(nbins);
+
+    vector<int64_t> local_grid;
+    local_grid.reserve(memnesia_node_footprint::grid_fields * nbins);
+    for (const auto &p : grid) {
+        local_grid.push_back(p.nranks);
+        local_grid.push_back(p.pss_in_kb);
+        local_grid.push_back(p.private_in_kb);
+        local_grid.push_back(p.mpi_in_kb);
+    }
+    if (0 == node_rank) node_grid.resize(local_grid.size());
+    if (MPI_SUCCESS != PMPI_Reduce(
+        local_grid.data(), node_grid.data(), int(local_grid.size()),
+        MPI_INT64_T, MPI_SUM, 0, node_comm
+    )) {
+        perror("PMPI_Reduce");
+        memnesia_exit_failure();
+    }
+}
+
+/**
+ *
+ */
+void
+memnesia_rt::report(void)
+{
+    //
     if (rank == 0) {
         printf(
-            "# Report written to %s\n",
-            report_name
+            "\n"
+            "\n#"
+            "\n# memnesia memory consumption analysis complete..."
+            "\n#"
+            "\n"
         );
     }
+    //
+    if (selected) numa.take_snapshot("MPI_Finalize", memnesia_time());
+    //
+    sync_clocks(true);
+    //
+    reduce_node_footprint();
+    //
+    write_heat_matrix();
+    //
+    if (report_format_enabled(MEMNESIA_REPORT_FORMAT_MEMNESIA)) {
+        write_report();
+    }
+    //
+    if (report_format_enabled(MEMNESIA_REPORT_FORMAT_PPROF) ||
+        report_format_enabled(MEMNESIA_REPORT_FORMAT_FOLDED)) {
+        write_profiles();
+    }
+    //
+    if (report_format_enabled(MEMNESIA_REPORT_FORMAT_CHROME)) {
+        write_trace_events();
+    }
 }
@@ -9,12 +9,28 @@
 #pragma once
 
 #include "memnesia.h"
+#include "memnesia-arena.h"
 #include "memnesia-sample.h"
+#include "memnesia-callsite.h"
+#include "memnesia-profile.h"
+#include "memnesia-footprint.h"
+#include "memnesia-telemetry.h"
+#include "memnesia-watchdog.h"
+#include "memnesia-log.h"
+#include "memnesia-numa.h"
+#include "memnesia-faults.h"
+#include "memnesia-heat.h"
+#include "memnesia-funcs.h"
+#include "memnesia-sampling.h"
+#include "memnesia-timer.h"
 
 #include <limits.h>
 
 #include <string>
 #include <sstream>
+#include <set>
+#include <utility>
+#include <vector>
 
 #include "mpi.h"
 
@@ -30,10 +46,183 @@ private:
     char app_comm[PATH_MAX];
     //
     memnesia_dataset dataset;
+    // (Function, communicator) pairs that have already been called.
+    memnesia_set< std::pair<memnesia_func_id, MPI_Fint> > contacted;
+    //
+    memnesia_callsite_table callsites;
+    //
+    memnesia_set<memnesia_string> report_formats;
+    //
+    std::string report_base_name;
+    // Whether or not MPI calls are currently being instrumented.
+    bool instrumenting = true;
+    // Phase names, indexed by phase identifier.
+    memnesia_vector<memnesia_string> phase_names {"default"};
+    //
+    uint32_t phase = 0;
+    //
+    memnesia_sampling sampling;
+    // RSS change (kB) since the last full smaps parse beyond which a new full
+    // parse is done. Negative means every sample is a full parse.
+    int64_t statm_gate_in_kb = -1;
+    // The last full sample and the RSS seen when it was taken.
+    memnesia_sample last_full_sample;
+    //
+    int64_t last_full_rss_in_kb = -1;
+    // Page faults since the last full smaps parse beyond which a new full
+    // parse is done. Negative disables this gate.
+    int64_t fault_gate = -1;
+    // Page faults counted when the last full parse was done.
+    int64_t last_full_faults = -1;
+    // Page-fault counters of the thread that initialized the tool.
+    memnesia_fault_counters faults;
+    // Whether or not page faults are tallied per MPI function.
+    bool count_call_faults = false;
+    //
+    memnesia_fault_counters::counts call_faults_before;
+    //
+    bool have_call_faults_before = false;
+    //
+    struct fault_stats {
+        //
+        int64_t calls = 0;
+        //
+        uint64_t faults = 0;
+        //
+        uint64_t minor = 0;
+        //
+        uint64_t major = 0;
+    };
+    //
+    fault_stats func_faults[MEMNESIA_FID_LAST];
+    //
+    void
+    set_fault_counters(void);
+    //
+    int64_t num_smaps_parses = 0;
+    //
+    int64_t num_statm_probes = 0;
+    // RSS seen by the most recent statm probe, if any.
+    int64_t last_rss_in_kb = -1;
+    // Maximum gap (seconds) between one caliper's "after" sample and the next
+    // caliper's "before" sample for the former to stand in for the latter.
+    // Negative means samples are never shared.
+    double share_gap = -1.0;
+    //
+    memnesia_sample last_after_sample;
+    // When the last "after" sample was completed.
+    double last_after_time = 0.0;
+    //
+    int64_t last_after_rss_in_kb = -1;
+    //
+    bool have_last_after_sample = false;
+    //
+    int64_t num_shared_samples = 0;
+    // Duplicate of MPI_COMM_WORLD used for all tool communication.
+    MPI_Comm tool_comm = MPI_COMM_NULL;
+    // Ranks sharing this rank's node.
+    MPI_Comm node_comm = MPI_COMM_NULL;
+    //
+    int node_rank = 0;
+    // Node leaders, for clock synchronization. MPI_COMM_NULL elsewhere.
+    MPI_Comm leader_comm = MPI_COMM_NULL;
+    // Maps local times onto rank 0's clock.
+    memnesia_clock_map clock;
+    //
+    bool clock_sync = true;
+    //
+    void
+    measure_clock_offset(
+        double &at_local_time,
+        double &local_minus_root
+    );
+    //
+    void
+    sync_clocks(bool at_finalize);
+    // Whether or not this rank is instrumented (see MEMNESIA_RANKS).
+    bool selected = true;
+    // Node footprint, merged on node leaders at finalize.
+    memnesia_node_footprint node_footprint;
+    // Node sums of the footprint grid (node leaders only).
+    memnesia_vector<int64_t> node_grid;
+    // Rank x time heat map buckets (see MEMNESIA_HEAT_BUCKETS).
+    memnesia_heat heat;
+    //
+    void
+    write_heat_matrix(void);
+    // Running MPI memory usage, i.e., the sum of MPI deltas so far.
+    int64_t mpi_usage_in_kb = 0;
+    // Live node-local telemetry (see MEMNESIA_TELEMETRY).
+    memnesia_telemetry telemetry;
+    //
+    void
+    set_telemetry(void);
+    //
+    memnesia_watchdog watchdog;
+    //
+    void
+    check_watchdog(
+        const memnesia_sample &happened_after,
+        int32_t callsite
+    );
+    //
+    void
+    write_partial_report(void);
+    // Crash-resilient sample log (see MEMNESIA_LOG_RECORDS).
+    memnesia_log log;
+    //
+    void
+    set_log(void);
+    // NUMA placement (see MEMNESIA_NUMA).
+    memnesia_numa numa;
+    // Where SIGUSR2-requested snapshots go. Empty if disabled.
+    std::string snapshot_dir;
+    //
+    int num_snapshots = 0;
+    //
+    void
+    set_snapshot_handler(void);
+    //
+    void
+    write_snapshot(const memnesia_sample &latest);
+    //
+    void
+    reduce_node_footprint(void);
+    //
+    void
+    select_ranks(void);
+    //
+    void
+    set_sampler_backend(void);
+    // Whether or not glibc heap entries are added to every sample.
+    bool heap_sampling = false;
+    //
+    void
+    set_heap_sampling(void);
+    //
+    void
+    set_statm_gate(void);
+    //
+    void
+    set_share_gap(void);
+    //
+    static MPI_Fint
+    comm_key(MPI_Comm comm);
     //
     memnesia_rt(void) {
         (void)memset(hostname, '\0', sizeof(hostname));
         (void)memset(app_comm, '\0', sizeof(app_comm));
+        set_sampler_backend();
+        sampling.init(memnesia_time());
+        node_footprint.init();
+        watchdog.init();
+        numa.init();
+        heat.init();
+        numa.take_snapshot("start", memnesia_time());
+        set_heap_sampling();
+        set_fault_counters();
+        set_statm_gate();
+        set_share_gap();
     }
     //
     ~memnesia_rt(void) = default;
@@ -56,14 +245,51 @@ private:
         memnesia_sample &delta
     );
     //
-    std::string
+    const char *
     get_output_path(void);
     //
     void
-    fill_report_buffer(std::stringstream &ss);
+    fill_run_info(memnesia_stringstream &ss);
+    //
+    void
+    fill_stats(memnesia_stringstream &ss);
+    //
+    void
+    fill_report_buffer(memnesia_stringstream &ss);
     //
     std::string
     aggregate_data(void);
+    //
+    std::string
+    gather_to_root(
+        const std::string &buff,
+        MPI_Comm comm
+    );
+    //
+    void
+    set_report_formats(void);
+    //
+    bool
+    report_format_enabled(
+        const std::string &format
+    );
+    //
+    void
+    set_report_base_name(void);
+    //
+    std::string
+    get_report_path(
+        const std::string &ext
+    );
+    //
+    void
+    write_report(void);
+    //
+    void
+    write_profiles(void);
+    //
+    void
+    write_trace_events(void);
 
 public:
     //
@@ -113,20 +339,113 @@ public:
         memnesia_sample &res
     );
     //
+    void
+    sample_before(
+        const std::string &what,
+        memnesia_sample &res
+    );
+    //
+    void
+    sample_after(
+        const std::string &what,
+        memnesia_sample &res
+    );
+    //
     static void
     sample_emit(
         const memnesia_sample &s
     );
     //
+    bool
+    first_contact(
+        memnesia_func_id fid,
+        MPI_Comm comm
+    );
+    //
+    void
+    forget_comm(MPI_Comm comm);
+    //
+    bool
+    is_selected(void);
+    //
+    void
+    seal_log(memnesia_log_state state)
+    {
+        log.seal(state, 0);
+    }
+    //
+    bool
+    instrumentation_enabled(void) const
+    {
+        return instrumenting;
+    }
+    //
+    void
+    set_instrumentation_enabled(bool enabled);
+    //
+    bool
+    admit_sample(
+        memnesia_func_id fid,
+        bool first_call
+    ) {
+        return sampling.admit(fid, first_call);
+    }
+    //
+    void
+    begin_call_faults(void)
+    {
+        if (!count_call_faults) return;
+        have_call_faults_before = faults.read(call_faults_before);
+    }
+    //
+    void
+    end_call_faults(memnesia_func_id fid);
+    //
+    void
+    mark_phase(const char *label);
+    //
+    void
+    sample_now(const char *label);
+    //
+    int32_t
+    capture_callsite(void)
+    {
+        return callsites.capture();
+    }
+    //
+    void
+    publish_telemetry(
+        const memnesia_sample &sample,
+        const char *func
+    ) {
+        if (!telemetry.enabled()) return;
+        telemetry.publish(
+            clock.since_origin(sample.get_capture_time()),
+            func,
+            sample.get_mem_usage_in_kb(),
+            mpi_usage_in_kb
+        );
+    }
+    //
     void
     add_samples_to_dataset(
         const memnesia_sample &happened_before,
-        const memnesia_sample &happened_after
+        const memnesia_sample &happened_after,
+        bool first_call,
+        int32_t callsite,
+        int64_t msg_bytes,
+        int32_t peer
     );
     //
     int64_t
     get_num_smaps_captures(void);
     //
+    int64_t
+    get_num_statm_probes(void);
+    //
+    int64_t
+    get_num_shared_samples(void);
+    //
     void
     report(void);
 };
@@ -135,7 +454,17 @@ class memnesia_scoped_caliper {
     //
     memnesia_rt *rt = nullptr;
     //
-    std::string callers_name;
+    memnesia_func_id fid = MEMNESIA_FID_LAST;
+    //
+    bool first_call = false;
+    //
+    int32_t callsite = memnesia_callsite_table::no_callsite;
+    // Size in bytes of the call's message, or -1 if it has none.
+    int64_t msg_bytes = -1;
+    // Rank of the call's peer (or root), or negative if it has none.
+    int32_t peer = -1;
+    // Whether or not instrumentation was enabled when the caliper was created.
+    bool active = false;
     //
     memnesia_sample before, after, delta;
     //
@@ -144,16 +473,40 @@ class memnesia_scoped_caliper {
 public:
     //
     memnesia_scoped_caliper(
-        const std::string &callers_name
+        memnesia_func_id fid,
+        MPI_Comm comm = MPI_COMM_NULL,
+        int count = 0,
+        MPI_Datatype datatype = MPI_DATATYPE_NULL,
+        int peer = -1
     ) : rt(memnesia_rt::the_memnesia_rt())
-      , callers_name(callers_name)
+      , fid(fid)
+      , peer(peer)
     {
-        rt->sample(callers_name, before);
+        // Contacts are only tracked while instrumenting, so disabled calls
+        // stay cheap.
+        if (!rt->instrumentation_enabled()) return;
+        first_call = rt->first_contact(fid, comm);
+        active = rt->admit_sample(fid, first_call);
+        if (!active) return;
+        if (MPI_DATATYPE_NULL != datatype) {
+            int type_size = 0;
+            if (MPI_SUCCESS == PMPI_Type_size(datatype, &type_size)) {
+                msg_bytes = int64_t(count) * type_size;
+            }
+        }
+        callsite = rt->capture_callsite();
+        rt->sample_before(memnesia_func_names[fid], before);
+        rt->publish_telemetry(before, memnesia_func_names[fid]);
+        rt->begin_call_faults();
     }
     //
     ~memnesia_scoped_caliper(void)
     {
-        rt->sample(callers_name, after);
-        rt->add_samples_to_dataset(before, after);
+        if (!active) return;
+        rt->end_call_faults(fid);
+        rt->sample_after(memnesia_func_names[fid], after);
+        rt->add_samples_to_dataset(
+            before, after, first_call, callsite, msg_bytes, peer
+        );
     }
 };
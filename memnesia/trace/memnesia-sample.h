@@ -9,23 +9,42 @@
 #pragma once
 
 #include "memnesia.h"
+#include "memnesia-arena.h"
 #include "memnesia-timer.h"
 #include "memnesia-sampler.h"
+#include "memnesia-callsite.h"
+#include "memnesia-profile.h"
+#include "memnesia-sampling.h"
 
 #include <sstream>
 #include <string>
+#include <iomanip>
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
+#include <map>
 #include <vector>
 
 class memnesia_sample {
     //
-    std::string target_func_name;
+    memnesia_string target_func_name;
     //
     double capture_time = 0.0;
     // Only valid for deltas.
     double duration = 0.0;
+    // Only valid for deltas. Whether or not this was the first call of the
+    // target function on a given communicator.
+    bool first_call = false;
+    // Only valid for deltas. Application call site of the target function.
+    int32_t callsite = memnesia_callsite_table::no_callsite;
+    // Only valid for deltas. Size in bytes of the message the target function
+    // sent or received, or -1 if it has none (see memnesia_func_traits).
+    int64_t msg_bytes = -1;
+    // Only valid for deltas. Rank of the target function's peer (or root), or
+    // negative if it has none.
+    int32_t peer = -1;
+    // Application phase (see memnesia_rt::mark_phase) the sample was taken in.
+    uint32_t phase = 0;
     //
     memnesia_smaps_sampler::sample smaps;
 
@@ -35,11 +54,18 @@ public:
     //
     memnesia_sample(
         const std::string &func_name
-    ) : target_func_name(func_name)
+    ) : target_func_name(func_name.c_str(), func_name.size())
       , capture_time(memnesia_time())
       , smaps(memnesia_smaps_sampler::get_sample()) { }
+    // For samples whose smaps values are known without parsing smaps again.
+    memnesia_sample(
+        const std::string &func_name,
+        const memnesia_smaps_sampler::sample &known_smaps
+    ) : target_func_name(func_name.c_str(), func_name.size())
+      , capture_time(memnesia_time())
+      , smaps(known_smaps) { }
     //
-    std::string
+    const memnesia_string &
     get_target_func_name(void) const
     {
         return target_func_name;
@@ -57,11 +83,81 @@ public:
         return duration;
     }
     //
+    bool
+    is_first_call(void) const
+    {
+        return first_call;
+    }
+    //
+    void
+    set_first_call(bool is_first)
+    {
+        first_call = is_first;
+    }
+    //
+    int32_t
+    get_callsite(void) const
+    {
+        return callsite;
+    }
+    //
+    void
+    set_callsite(int32_t id)
+    {
+        callsite = id;
+    }
+    //
+    int64_t
+    get_msg_bytes(void) const
+    {
+        return msg_bytes;
+    }
+    //
+    int32_t
+    get_peer(void) const
+    {
+        return peer;
+    }
+    //
+    void
+    set_message(int64_t bytes, int32_t peer_rank)
+    {
+        msg_bytes = bytes;
+        peer = peer_rank;
+    }
+    //
+    const memnesia_smaps_sampler::sample &
+    get_smaps(void) const
+    {
+        return smaps;
+    }
+    //
+    uint32_t
+    get_phase(void) const
+    {
+        return phase;
+    }
+    //
+    void
+    set_phase(uint32_t phase_id)
+    {
+        phase = phase_id;
+    }
+    // Adds the glibc heap entries to a sample from any backend.
+    void
+    sample_heap(void)
+    {
+        (void)memnesia_sampler_backend<
+            memnesia_smaps_sampler::MALLINFO2
+        >::sample(smaps);
+    }
+    //
     int64_t
     get_mem_usage_in_kb(
         int64_t *running_total = nullptr
     ) const {
-        const int64_t samp_usage = smaps.data_in_kb[memnesia_smaps_sampler::PSS];
+        const int64_t samp_usage =
+            smaps.data_in_kb[memnesia_smaps_sampler::get_usage_entry()];
         if (running_total) {
             *running_total += samp_usage;
             return *running_total;
@@ -80,7 +176,7 @@ public:
         auto &before = happened_before;
         auto &after = happened_after;
 
-        string func_name;
+        memnesia_string func_name;
         // The same, so pick one.
         if (before.target_func_name == after.target_func_name) {
             func_name = after.target_func_name;
@@ -94,6 +190,11 @@ public:
         delta.target_func_name = func_name;
         delta.capture_time = after.capture_time;
         delta.duration = after.capture_time - before.capture_time;
+        delta.first_call = false;
+        delta.callsite = memnesia_callsite_table::no_callsite;
+        delta.msg_bytes = -1;
+        delta.peer = -1;
+        delta.phase = before.phase;
         //
         memnesia_smaps_sampler::sample::delta(
             before.smaps,
@@ -112,6 +213,8 @@ public:
         cout << "# Function Name: " << s.target_func_name << endl;
         cout << "# Capture Time : " << s.capture_time << endl;
         cout << "# Duration     : " << s.duration << endl;
+        cout << "# First Call   : " << s.first_call << endl;
+        cout << "# Phase        : " << s.phase << endl;
         memnesia_smaps_sampler::sample::emit(s.smaps);
         cout << "# ###############################################" << endl;
     }
@@ -128,9 +231,9 @@ public:
 
 private:
     //
-    std::map< type_id, std::vector<memnesia_sample> > data;
+    memnesia_map< type_id, memnesia_vector<memnesia_sample> > data;
     //
-    std::vector<std::string> tid_name_tab {
+    memnesia_vector<memnesia_string> tid_name_tab {
         "MPI_MEM_USAGE",
         "ALL_MEM_USAGE"
     };
@@ -154,9 +257,9 @@ public:
     //
     void
     report(
-        std::stringstream &ss,
+        memnesia_stringstream &ss,
         type_id tid,
-        double since
+        const memnesia_clock_map &clock
     ) {
         int64_t mem_total = 0;
         // To keep track of MPI usage, we have to sum the deltas. APP usage is
@@ -166,12 +269,370 @@ public:
         for (const auto &d : data[tid]) {
             ss << tid_name_tab[tid] << " "
                << d.get_target_func_name() << " "
-               << d.get_capture_time() - since << " "
+               << clock.since_origin(d.get_capture_time()) << " "
                <<  memnesia_util_kb2mb(d.get_mem_usage_in_kb(mtbp))
                << std::endl;
         }
     }
     //
+    void
+    report_func_stats(
+        memnesia_stringstream &ss
+    ) {
+        // Per-function MPI memory usage statistics. A function's first call
+        // on a given communicator is tallied separately from its subsequent
+        // (steady-state) calls, since many MPI implementations lazily
+        // allocate internal state on first use.
+        struct func_stats {
+            int64_t first_calls = 0;
+            int64_t first_total = 0;
+            int64_t steady_calls = 0;
+            int64_t steady_total = 0;
+            int64_t steady_min = 0;
+            int64_t steady_max = 0;
+        };
+        memnesia_map<memnesia_string, func_stats> stats;
+
+        for (const auto &d : data[MPI]) {
+            auto &fs = stats[d.get_target_func_name()];
+            const int64_t dkb = d.get_mem_usage_in_kb();
+            if (d.is_first_call()) {
+                fs.first_calls++;
+                fs.first_total += dkb;
+                continue;
+            }
+            if (0 == fs.steady_calls) {
+                fs.steady_min = dkb;
+                fs.steady_max = dkb;
+            }
+            fs.steady_calls++;
+            fs.steady_total += dkb;
+            fs.steady_min = dkb < fs.steady_min ? dkb : fs.steady_min;
+            fs.steady_max = dkb > fs.steady_max ? dkb : fs.steady_max;
+        }
+
+        for (const auto &fsi : stats) {
+            const auto &fs = fsi.second;
+            const double steady_mean = (0 == fs.steady_calls) ? 0.0 :
+                double(fs.steady_total) / double(fs.steady_calls);
+            ss << "MPI_FUNC_STATS" << " "
+               << fsi.first << " "
+               << fs.first_calls << " "
+               << memnesia_util_kb2mb(fs.first_total) << " "
+               << fs.steady_calls << " "
+               << memnesia_util_kb2mb(fs.steady_total) << " "
+               << memnesia_util_kb2mb(fs.steady_min) << " "
+               << memnesia_util_kb2mb(steady_mean) << " "
+               << memnesia_util_kb2mb(fs.steady_max)
+               << std::endl;
+        }
+    }
+    //
+    void
+    report_heap_stats(
+        memnesia_stringstream &ss
+    ) {
+        // Net changes across each function's calls. Memory freed into the
+        // allocator but not returned to the system shows up as free growth,
+        // not in-use growth.
+        struct heap_stats {
+            int64_t calls = 0;
+            int64_t inuse = 0;
+            int64_t free = 0;
+            int64_t arena = 0;
+            int64_t mmapped = 0;
+        };
+        memnesia_map<memnesia_string, heap_stats> stats;
+
+        for (const auto &d : data[MPI]) {
+            auto &hs = stats[d.get_target_func_name()];
+            const auto &kb = d.get_smaps().data_in_kb;
+            hs.calls++;
+            hs.inuse += kb[memnesia_smaps_sampler::HEAP_INUSE];
+            hs.free += kb[memnesia_smaps_sampler::HEAP_FREE];
+            hs.arena += kb[memnesia_smaps_sampler::HEAP_ARENA];
+            hs.mmapped += kb[memnesia_smaps_sampler::HEAP_MMAPPED];
+        }
+
+        for (const auto &hsi : stats) {
+            const auto &hs = hsi.second;
+            ss << "MPI_FUNC_HEAP" << " "
+               << hsi.first << " "
+               << hs.calls << " "
+               << memnesia_util_kb2mb(hs.inuse) << " "
+               << memnesia_util_kb2mb(hs.free) << " "
+               << memnesia_util_kb2mb(hs.arena) << " "
+               << memnesia_util_kb2mb(hs.mmapped)
+               << std::endl;
+        }
+        // Where the heap ended up.
+        if (data[APP].empty()) return;
+        const auto &kb = data[APP].back().get_smaps().data_in_kb;
+        static const memnesia_smaps_sampler::entry_id ids[] = {
+            memnesia_smaps_sampler::HEAP_INUSE,
+            memnesia_smaps_sampler::HEAP_FREE,
+            memnesia_smaps_sampler::HEAP_ARENA,
+            memnesia_smaps_sampler::HEAP_MMAPPED,
+            memnesia_smaps_sampler::HEAP_KEEPCOST
+        };
+        ss << "HEAP_SUMMARY";
+        for (const auto id : ids) {
+            ss << " " << memnesia_util_kb2mb(kb[id]);
+        }
+        ss << std::endl;
+    }
+    //
+    void
+    report_callsite_stats(
+        memnesia_stringstream &ss,
+        const memnesia_callsite_table &callsites
+    ) {
+        struct callsite_stats {
+            memnesia_string func_name;
+            int64_t calls = 0;
+            int64_t total = 0;
+            int64_t min = 0;
+            int64_t max = 0;
+        };
+        memnesia_map<int32_t, callsite_stats> stats;
+
+        for (const auto &d : data[MPI]) {
+            const int32_t id = d.get_callsite();
+            if (memnesia_callsite_table::no_callsite == id) continue;
+
+            auto &cs = stats[id];
+            const int64_t dkb = d.get_mem_usage_in_kb();
+            if (0 == cs.calls) {
+                cs.func_name = d.get_target_func_name();
+                cs.min = dkb;
+                cs.max = dkb;
+            }
+            cs.calls++;
+            cs.total += dkb;
+            cs.min = dkb < cs.min ? dkb : cs.min;
+            cs.max = dkb > cs.max ? dkb : cs.max;
+        }
+
+        for (const auto &csi : stats) {
+            const auto &cs = csi.second;
+            ss << "MPI_CALLSITE_STATS" << " "
+               << csi.first << " "
+               << cs.func_name << " "
+               << cs.calls << " "
+               << memnesia_util_kb2mb(cs.total) << " "
+               << memnesia_util_kb2mb(cs.min) << " "
+               << memnesia_util_kb2mb(cs.max)
+               << std::endl;
+            // Innermost (calling) frame first.
+            const auto &frames = callsites.get_stack(csi.first);
+            for (size_t i = 0; i < frames.size(); ++i) {
+                ss << "MPI_CALLSITE_FRAME" << " "
+                   << csi.first << " "
+                   << i << " "
+                   << memnesia_callsite_table::symbolize(frames[i])
+                   << std::endl;
+            }
+        }
+    }
+    //
+    void
+    report_sampling_stats(
+        memnesia_stringstream &ss,
+        const memnesia_sampling &sampling
+    ) {
+        // Skipped calls are assumed to behave like sampled steady-state calls,
+        // so the extrapolated total is the first-call total plus the
+        // steady-state mean times the number of non-first calls.
+        struct totals {
+            int64_t first_calls = 0;
+            int64_t first_total = 0;
+            int64_t steady_calls = 0;
+            int64_t steady_total = 0;
+        };
+        memnesia_map<memnesia_string, totals> tots;
+
+        for (const auto &d : data[MPI]) {
+            auto &t = tots[d.get_target_func_name()];
+            if (d.is_first_call()) {
+                t.first_calls++;
+                t.first_total += d.get_mem_usage_in_kb();
+            }
+            else {
+                t.steady_calls++;
+                t.steady_total += d.get_mem_usage_in_kb();
+            }
+        }
+
+        for (int fid = 0; fid < MEMNESIA_FID_LAST; ++fid) {
+            const auto &fs = sampling.get_state(memnesia_func_id(fid));
+            if (0 == fs.calls) continue;
+
+            const auto &t = tots[memnesia_func_names[fid]];
+            const double steady_mean = (0 == t.steady_calls) ? 0.0 :
+                double(t.steady_total) / double(t.steady_calls);
+            const double extrapolated = double(t.first_total) +
+                steady_mean * double(fs.calls - t.first_calls);
+
+            ss << "MPI_FUNC_SAMPLING" << " "
+               << memnesia_func_names[fid] << " "
+               << fs.calls << " "
+               << fs.sampled << " "
+               << fs.skipped << " "
+               << memnesia_util_kb2mb(extrapolated)
+               << std::endl;
+        }
+    }
+    //
+    void
+    report_phase_stats(
+        memnesia_stringstream &ss,
+        const memnesia_vector<memnesia_string> &phase_names
+    ) {
+        struct phase_stats {
+            int64_t samples = 0;
+            int64_t app_min = 0;
+            int64_t app_max = 0;
+            // Change in application memory usage summed over every contiguous
+            // stretch of time spent in the phase.
+            int64_t app_growth = 0;
+            int64_t mpi_growth = 0;
+            int64_t mpi_net = 0;
+        };
+        memnesia_vector<phase_stats> stats(phase_names.size());
+
+        const memnesia_sample *stretch_begin = nullptr, *prev = nullptr;
+        for (const auto &d : data[APP]) {
+            auto &ps = stats[d.get_phase()];
+            const int64_t kb = d.get_mem_usage_in_kb();
+            if (0 == ps.samples) {
+                ps.app_min = kb;
+                ps.app_max = kb;
+            }
+            ps.samples++;
+            ps.app_min = kb < ps.app_min ? kb : ps.app_min;
+            ps.app_max = kb > ps.app_max ? kb : ps.app_max;
+            // Phase change, so close out the previous stretch.
+            if (prev && prev->get_phase() != d.get_phase()) {
+                stats[prev->get_phase()].app_growth +=
+                    prev->get_mem_usage_in_kb() -
+                    stretch_begin->get_mem_usage_in_kb();
+                stretch_begin = nullptr;
+            }
+            if (!stretch_begin) stretch_begin = &d;
+            prev = &d;
+        }
+        if (prev) {
+            stats[prev->get_phase()].app_growth +=
+                prev->get_mem_usage_in_kb() -
+                stretch_begin->get_mem_usage_in_kb();
+        }
+
+        for (const auto &d : data[MPI]) {
+            auto &ps = stats[d.get_phase()];
+            const int64_t dkb = d.get_mem_usage_in_kb();
+            ps.mpi_growth += dkb > 0 ? dkb : 0;
+            ps.mpi_net += dkb;
+        }
+
+        for (size_t i = 0; i < stats.size(); ++i) {
+            const auto &ps = stats[i];
+            ss << "PHASE_STATS" << " "
+               << phase_names[i] << " "
+               << ps.samples << " "
+               << memnesia_util_kb2mb(ps.app_min) << " "
+               << memnesia_util_kb2mb(ps.app_max) << " "
+               << memnesia_util_kb2mb(ps.app_growth) << " "
+               << memnesia_util_kb2mb(ps.mpi_growth) << " "
+               << memnesia_util_kb2mb(ps.mpi_net)
+               << std::endl;
+        }
+    }
+    // Trace Event Format (chrome://tracing, Perfetto) events, each preceded by
+    // a comma. MPI calls are complete events; memory usage is two counters.
+    void
+    report_trace_events(
+        memnesia_stringstream &ss,
+        int pid,
+        const memnesia_clock_map &clock
+    ) {
+        // Microseconds, to the nanosecond.
+        auto ts = [&clock](double local_time) {
+            return clock.since_origin(local_time) * 1e6;
+        };
+        const auto flags = ss.flags();
+        const auto prec = ss.precision();
+        ss << std::fixed << std::setprecision(3);
+
+        int64_t mpi_total = 0;
+        for (const auto &d : data[MPI]) {
+            const double end = d.get_capture_time();
+            const int64_t total_kb = d.get_mem_usage_in_kb(&mpi_total);
+            ss << ",\n{\"ph\":\"X\",\"name\":\""
+               << d.get_target_func_name()
+               << "\",\"cat\":\"MPI\",\"pid\":" << pid
+               << ",\"tid\":0,\"ts\":" << ts(end - d.get_duration())
+               << ",\"dur\":" << d.get_duration() * 1e6
+               << ",\"args\":{\"mpi_delta_mb\":"
+               << memnesia_util_kb2mb(d.get_mem_usage_in_kb())
+               << ",\"first_call\":" << (d.is_first_call() ? 1 : 0)
+               << ",\"phase\":" << d.get_phase();
+            if (d.get_msg_bytes() >= 0) {
+                ss << ",\"bytes\":" << d.get_msg_bytes();
+            }
+            if (d.get_peer() >= 0) ss << ",\"peer\":" << d.get_peer();
+            ss << "}}";
+            ss << ",\n{\"ph\":\"C\",\"name\":\"MPI (MB)\",\"pid\":"
+               << pid << ",\"ts\":" << ts(end)
+               << ",\"args\":{\"MPI\":" << memnesia_util_kb2mb(total_kb)
+               << "}}";
+        }
+        for (const auto &d : data[APP]) {
+            ss << ",\n{\"ph\":\"C\",\"name\":\"APP (MB)\",\"pid\":"
+               << pid << ",\"ts\":" << ts(d.get_capture_time())
+               << ",\"args\":{\"APP\":"
+               << memnesia_util_kb2mb(d.get_mem_usage_in_kb()) << "}}";
+        }
+        ss.flags(flags);
+        ss.precision(prec);
+    }
+    //
+    void
+    fill_profile(
+        memnesia_profile &profile,
+        const memnesia_callsite_table &callsites
+    ) {
+        // Folded stacks are cached per call site, since symbolization is
+        // comparatively expensive.
+        std::map<int32_t, std::string> folded_tab;
+
+        for (const auto &d : data[MPI]) {
+            const int32_t id = d.get_callsite();
+            auto got = folded_tab.find(id);
+            if (got == folded_tab.end()) {
+                std::string folded;
+                if (memnesia_callsite_table::no_callsite != id) {
+                    const auto &frames = callsites.get_stack(id);
+                    // Outermost frame first.
+                    for (auto f = frames.rbegin(); f != frames.rend(); ++f) {
+                        memnesia_string fname =
+                            memnesia_callsite_table::function_name(*f);
+                        // ';' separates frames, so it can't be in a name.
+                        for (auto &c : fname) {
+                            if (';' == c) c = ':';
+                        }
+                        folded.append(fname.data(), fname.size());
+                        folded += ";";
+                    }
+                }
+                got = folded_tab.insert(
+                    make_pair(id, folded + d.get_target_func_name().c_str())
+                ).first;
+            }
+            const int64_t dkb = d.get_mem_usage_in_kb();
+            profile.add(got->second, dkb > 0 ? dkb : 0, dkb, 1);
+        }
+    }
+    //
     int64_t
     get_high_mem_usage_watermark_in_kb(
         type_id tid
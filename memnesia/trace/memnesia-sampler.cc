@@ -7,10 +7,17 @@
  */
 
 #include "memnesia-sampler.h"
+#include "memnesia-arena.h"
 
+#include <ctype.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <malloc.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <string>
 #include <utility>
 #include <vector>
 #include <iostream>
@@ -29,33 +36,33 @@ class smaps_parser {
     static constexpr bool eop = true;
     //
     static int64_t
-    to_int64(const string &str)
+    to_int64(const memnesia_string &str)
     {
-        return int64_t(std::stoll(str, 0, 10));
+        return int64_t(strtoll(str.c_str(), nullptr, 10));
     }
     //
     static void
     tok_it(
         char *buff,
         const string &delim,
-        vector<string> &toks
+        memnesia_vector<memnesia_string> &toks
     ) {
         char *tokp = nullptr, *strp = buff;
         while ((tokp = strtok(strp, delim.c_str()))) {
-            toks.push_back(string(tokp));
+            toks.push_back(memnesia_string(tokp));
             strp = nullptr;
         }
     }
     //
     static bool
     has_suffix(
-        const std::string &str,
+        const memnesia_string &str,
         const std::string &suffix
     ) {
         return str.size() >= suffix.size() &&
                str.compare(
                     str.size() - suffix.size(),
-                    suffix.size(), suffix
+                    suffix.size(), suffix.c_str()
                 ) == 0;
     }
     //
@@ -65,10 +72,17 @@ class smaps_parser {
         // Format
         // address           perms offset   dev   inode   pathname
         // 08048000-08056000 r-xp  00000000 03:0c 64593   /usr/sbin/gpm
-        vector<string> toks(max_toks);
+        //
+        // Skip the tool's own memory (see memnesia_arena).
+        char *endp = nullptr;
+        const uintptr_t lo = uintptr_t(strtoull(header, &endp, 16));
+        const uintptr_t hi = uintptr_t(strtoull(endp + 1, nullptr, 16));
+        if (memnesia_arena::is_tool_mapping(lo, hi)) return true;
+
+        memnesia_vector<memnesia_string> toks(max_toks);
         toks.reserve(max_toks);
         tok_it(header, " ", toks);
-        string pathname = toks.back();
+        memnesia_string pathname = toks.back();
         // Remove '\n'
         pathname = pathname.substr(0, pathname.length() - 1);
         // Skip all entries that end with memnesia-trace.so
@@ -105,15 +119,15 @@ class smaps_parser {
         // 0                     1    2
         // Key:                  Size Units
         while (fgets(lbuff, gets_size, smapsf)) {
-            vector<string> toks;
+            memnesia_vector<memnesia_string> toks;
             toks.reserve(max_toks);
             tok_it(lbuff, " ", toks);
             // Remove ':'
-            string key   = toks[kidx].substr(0, toks[kidx].length() - 1);
+            const string key(toks[kidx].c_str(), toks[kidx].length() - 1);
             // Nothing to remove.
-            string value = toks[vidx];
+            const memnesia_string &value = toks[vidx];
             // Remove '\n'
-            string units = toks[uidx].substr(0, toks[uidx].length() - 1);
+            const string units(toks[uidx].c_str(), toks[uidx].length() - 1);
             auto got = memnesia_smaps_sampler::tokid_tab.find(key);
             // We found a key that we care about.
             if (got != memnesia_smaps_sampler::tokid_tab.end()) {
@@ -148,10 +162,8 @@ public:
 
     //
     static memnesia_smaps_sampler::sample
-    parse(void)
+    parse(const char *f_name = "/proc/self/smaps")
     {
-        static const char *f_name = "/proc/self/smaps";
-
         FILE *smapsf = fopen(f_name, "r");
         if (!smapsf) {
             perror("fopen");
@@ -197,11 +209,471 @@ memnesia_smaps_sampler::tokid_tab = {
     make_pair("VmFlags",         memnesia_smaps_sampler::LAST)
 };
 
+namespace {
+//
+struct backend_info {
+    //
+    const char *name;
+    //
+    uint64_t fields;
+    //
+    memnesia_smaps_sampler::entry_id usage;
+    //
+    bool (*sample)(memnesia_smaps_sampler::sample &);
+};
+
+//
+template <memnesia_smaps_sampler::backend_id B>
+backend_info
+make_backend_info(void)
+{
+    using backend = memnesia_sampler_backend<B>;
+    return backend_info {
+        backend::name(), backend::fields, backend::usage, backend::sample
+    };
+}
+
+//
+const backend_info backends[memnesia_smaps_sampler::BACKEND_LAST] = {
+    make_backend_info<memnesia_smaps_sampler::SMAPS>(),
+    make_backend_info<memnesia_smaps_sampler::SMAPS_ROLLUP>(),
+    make_backend_info<memnesia_smaps_sampler::STATM>(),
+    make_backend_info<memnesia_smaps_sampler::STATUS>(),
+    make_backend_info<memnesia_smaps_sampler::MALLINFO2>()
+};
+
+/**
+ * Reads a small /proc file in one go.
+ */
+bool
+read_proc_file(
+    const char *f_name,
+    char *buff,
+    size_t buff_size
+) {
+    const int fd = open(f_name, O_RDONLY);
+    if (-1 == fd) return false;
+    const ssize_t nr = read(fd, buff, buff_size - 1);
+    (void)close(fd);
+    if (nr <= 0) return false;
+    buff[nr] = '\0';
+    return true;
+}
+} // namespace
+
+memnesia_smaps_sampler::backend_id
+memnesia_smaps_sampler::backend = memnesia_smaps_sampler::SMAPS;
+
 /**
  *
  */
 memnesia_smaps_sampler::sample
 memnesia_smaps_sampler::get_sample_impl(void)
 {
-    return smaps_parser::parse();
+    sample result;
+    (void)backends[backend].sample(result);
+    return result;
+}
+
+/**
+ *
+ */
+bool
+memnesia_smaps_sampler::set_backend(const std::string &name)
+{
+    for (int b = 0; b < BACKEND_LAST; ++b) {
+        if (name != backends[b].name) continue;
+        // Make sure that the source is there.
+        sample probe;
+        if (!backends[b].sample(probe)) return false;
+        backend = backend_id(b);
+        return true;
+    }
+    return false;
+}
+
+/**
+ *
+ */
+const char *
+memnesia_smaps_sampler::get_backend_name(void)
+{
+    return backends[backend].name;
+}
+
+/**
+ *
+ */
+uint64_t
+memnesia_smaps_sampler::get_backend_fields(void)
+{
+    return backends[backend].fields;
+}
+
+/**
+ *
+ */
+memnesia_smaps_sampler::entry_id
+memnesia_smaps_sampler::get_usage_entry(void)
+{
+    return backends[backend].usage;
+}
+
+/**
+ *
+ */
+bool
+memnesia_sampler_backend<memnesia_smaps_sampler::SMAPS>::sample(
+    memnesia_smaps_sampler::sample &s
+) {
+    s = smaps_parser::parse();
+    return true;
+}
+
+/**
+ *
+ */
+bool
+memnesia_sampler_backend<memnesia_smaps_sampler::SMAPS_ROLLUP>::sample(
+    memnesia_smaps_sampler::sample &s
+) {
+    static const char *f_name = "/proc/self/smaps_rollup";
+    if (0 != access(f_name, R_OK)) return false;
+    s = smaps_parser::parse(f_name);
+    return true;
+}
+
+/**
+ *
+ */
+bool
+memnesia_sampler_backend<memnesia_smaps_sampler::STATM>::sample(
+    memnesia_smaps_sampler::sample &s
+) {
+    static const int64_t page_kb = int64_t(sysconf(_SC_PAGESIZE)) / 1024;
+
+    char buff[128];
+    if (!read_proc_file("/proc/self/statm", buff, sizeof(buff))) return false;
+    // Format: size resident shared text lib data dt (in pages).
+    long long size = 0, resident = 0;
+    if (2 != sscanf(buff, "%lld %lld", &size, &resident)) return false;
+
+    s.data_in_kb[memnesia_smaps_sampler::SIZE] = int64_t(size) * page_kb;
+    s.data_in_kb[memnesia_smaps_sampler::RSS] = int64_t(resident) * page_kb;
+    return true;
+}
+
+/**
+ *
+ */
+bool
+memnesia_sampler_backend<memnesia_smaps_sampler::STATUS>::sample(
+    memnesia_smaps_sampler::sample &s
+) {
+    static const map<string, memnesia_smaps_sampler::entry_id> keys = {
+        make_pair("VmSize",  memnesia_smaps_sampler::SIZE),
+        make_pair("VmRSS",   memnesia_smaps_sampler::RSS),
+        make_pair("RssAnon", memnesia_smaps_sampler::ANONYMOUS),
+        make_pair("VmSwap",  memnesia_smaps_sampler::SWAP),
+        make_pair("VmLck",   memnesia_smaps_sampler::LOCKED)
+    };
+
+    char buff[4096];
+    if (!read_proc_file("/proc/self/status", buff, sizeof(buff))) return false;
+
+    char *save = nullptr;
+    for (char *line = strtok_r(buff, "\n", &save); line;
+         line = strtok_r(nullptr, "\n", &save)) {
+        char key[64];
+        long long value = 0;
+        // Format: Key:    Value kB
+        if (2 != sscanf(line, "%63[^:]: %lld", key, &value)) continue;
+        const auto got = keys.find(key);
+        if (got != keys.end()) {
+            s.data_in_kb[got->second] = int64_t(value);
+        }
+    }
+    return true;
+}
+
+/**
+ * mallinfo2 appeared in glibc 2.33; mallinfo's int fields wrap past 2 GB.
+ */
+bool
+memnesia_sampler_backend<memnesia_smaps_sampler::MALLINFO2>::sample(
+    memnesia_smaps_sampler::sample &s
+) {
+#if defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const struct mallinfo2 mi = mallinfo2();
+#else
+    const struct mallinfo mi = mallinfo();
+#endif
+    s.data_in_kb[memnesia_smaps_sampler::HEAP_ARENA] = int64_t(mi.arena) / 1024;
+    s.data_in_kb[memnesia_smaps_sampler::HEAP_INUSE] =
+        int64_t(mi.uordblks + mi.hblkhd) / 1024;
+    s.data_in_kb[memnesia_smaps_sampler::HEAP_FREE] =
+        int64_t(mi.fordblks) / 1024;
+    s.data_in_kb[memnesia_smaps_sampler::HEAP_MMAPPED] =
+        int64_t(mi.hblkhd) / 1024;
+    s.data_in_kb[memnesia_smaps_sampler::HEAP_KEEPCOST] =
+        int64_t(mi.keepcost) / 1024;
+    return true;
+}
+
+/**
+ * Reads /proc/self/statm, a single short line, with a single read(2).
+ */
+bool
+memnesia_statm_sampler::get_rss_in_kb(int64_t &rss_in_kb)
+{
+    static const int64_t page_kb = int64_t(sysconf(_SC_PAGESIZE)) / 1024;
+
+    const int fd = open("/proc/self/statm", O_RDONLY);
+    if (-1 == fd) return false;
+
+    char buff[128];
+    const ssize_t nr = read(fd, buff, sizeof(buff) - 1);
+    (void)close(fd);
+    if (nr <= 0) return false;
+    buff[nr] = '\0';
+    // Format: size resident shared text lib data dt (in pages).
+    long long size = 0, resident = 0;
+    if (2 != sscanf(buff, "%lld %lld", &size, &resident)) return false;
+
+    rss_in_kb = int64_t(resident) * page_kb;
+    return true;
+}
+
+/**
+ * Walks /proc/self/smaps one mapping at a time. Only the handful of fields
+ * needed per mapping are looked at, so sscanf(3) suffices here.
+ */
+bool
+memnesia_mappings_sampler::get_mappings(memnesia_vector<mapping> &mappings)
+{
+    FILE *smapsf = fopen("/proc/self/smaps", "r");
+    if (!smapsf) return false;
+
+    static const char trace_lib[] = "memnesia-trace.so";
+    static const size_t trace_lib_len = sizeof(trace_lib) - 1;
+
+    mapping cur;
+    bool skip = true;
+
+    char lbuff[2 * PATH_MAX];
+    while (fgets(lbuff, sizeof(lbuff), smapsf)) {
+        unsigned long long lo = 0, hi = 0, offset = 0, inode = 0;
+        char perms[8], dev[32], key[64];
+        long long value = 0;
+        int path_at = 0;
+        // Format
+        // address           perms offset   dev   inode   pathname
+        // 08048000-08056000 r-xp  00000000 03:0c 64593   /usr/sbin/gpm
+        if (6 == sscanf(
+                lbuff, "%llx-%llx %7s %llx %31s %llu %n",
+                &lo, &hi, perms, &offset, dev, &inode, &path_at
+            )) {
+            if (!skip) mappings.push_back(cur);
+            memnesia_string path(lbuff + path_at);
+            if (!path.empty() && path.back() == '\n') path.pop_back();
+            skip = memnesia_arena::is_tool_mapping(
+                       uintptr_t(lo), uintptr_t(hi)
+                   ) ||
+                   (path.size() >= trace_lib_len &&
+                    0 == path.compare(
+                        path.size() - trace_lib_len, trace_lib_len, trace_lib
+                    ));
+            char file[64];
+            (void)snprintf(file, sizeof(file), "%s:%llu", dev, inode);
+            cur = mapping();
+            cur.inode = inode;
+            cur.file = file;
+            cur.start = uintptr_t(lo);
+            cur.end = uintptr_t(hi);
+            cur.offset = offset;
+            cur.name.assign(lbuff, size_t(strchr(lbuff, ' ') - lbuff));
+            cur.name += " ";
+            cur.name += perms;
+            if (!path.empty()) cur.name += " " + path;
+            if (0 != inode) {
+                cur.region = cur.file + " " + perms + " " + path;
+            }
+            else if (!path.empty()) {
+                cur.region = memnesia_string(perms) + " " + path;
+            }
+            else {
+                cur.region.assign(lbuff, size_t(strchr(lbuff, '-') - lbuff));
+                cur.region += " ";
+                cur.region += perms;
+            }
+        }
+        else if (2 == sscanf(lbuff, "%63[^:]: %lld", key, &value)) {
+            if (0 == strcmp(key, "Pss")) {
+                cur.pss_in_kb += value;
+            }
+            else if (0 == strcmp(key, "Private_Clean") ||
+                     0 == strcmp(key, "Private_Dirty")) {
+                cur.private_in_kb += value;
+            }
+            else if (0 == strcmp(key, "Shared_Clean") ||
+                     0 == strcmp(key, "Shared_Dirty")) {
+                cur.shared_in_kb += value;
+            }
+        }
+    }
+    if (!skip) mappings.push_back(cur);
+
+    fclose(smapsf);
+
+    return true;
+}
+
+/**
+ * Appends to runs the file page indices of m's resident file pages that are
+ * also mapped elsewhere, i.e., those smaps counts as Shared_*. Without
+ * privileges, pagemap zeroes page frame numbers, but these flags remain.
+ */
+static bool
+add_shared_pages(
+    int pagemapfd,
+    const memnesia_mappings_sampler::mapping &m,
+    memnesia_footprint_sampler::page_runs &runs
+) {
+    static const uint64_t present = uint64_t(1) << 63;
+    static const uint64_t file_or_shmem = uint64_t(1) << 61;
+    static const uint64_t exclusive = uint64_t(1) << 56;
+    static const uintptr_t page_size = uintptr_t(sysconf(_SC_PAGESIZE));
+
+    const uint64_t first_index = m.offset / page_size;
+    const uintptr_t npages = (m.end - m.start) / page_size;
+
+    uint64_t entries[512];
+    for (uintptr_t done = 0; done < npages; ) {
+        const uintptr_t n = std::min<uintptr_t>(
+            npages - done, sizeof(entries) / sizeof(entries[0])
+        );
+        const off_t at = off_t((m.start / page_size + done) * sizeof(uint64_t));
+        const ssize_t nread = pread(
+            pagemapfd, entries, n * sizeof(uint64_t), at
+        );
+        if (nread <= 0) return false;
+        const uintptr_t nentries = uintptr_t(nread) / sizeof(uint64_t);
+        for (uintptr_t i = 0; i < nentries; ++i) {
+            const uint64_t e = entries[i];
+            if (!(e & present) || !(e & file_or_shmem) || (e & exclusive)) {
+                continue;
+            }
+            const uint64_t index = first_index + done + i;
+            if (!runs.empty() &&
+                runs.back().first + runs.back().second == index) {
+                runs.back().second++;
+            }
+            else {
+                runs.push_back(std::make_pair(index, uint64_t(1)));
+            }
+        }
+        done += nentries;
+    }
+    return true;
+}
+
+/**
+ * Shared file and shmem pages are taken from pagemap. Private pages, which
+ * include pages of files no other process maps, are summed as is.
+ */
+bool
+memnesia_footprint_sampler::get_footprint(footprint &fp)
+{
+    memnesia_vector<memnesia_mappings_sampler::mapping> mappings;
+    if (!memnesia_mappings_sampler::get_mappings(mappings)) return false;
+
+    const int pagemapfd = open("/proc/self/pagemap", O_RDONLY);
+    bool ok = (-1 != pagemapfd);
+
+    for (const auto &m : mappings) {
+        fp.pss_in_kb += m.pss_in_kb;
+        fp.private_in_kb += m.private_in_kb;
+        if (0 == m.shared_in_kb) continue;
+        // Anonymous (inode 0) mappings can't be matched across processes.
+        if (0 == m.inode) {
+            fp.anon_shared_in_kb += m.pss_in_kb - m.private_in_kb;
+            continue;
+        }
+        if (!ok) continue;
+        ok = add_shared_pages(
+            pagemapfd, m,
+            fp.shared_pages[m.file]
+        );
+    }
+    if (-1 != pagemapfd) close(pagemapfd);
+
+    return ok;
+}
+
+/**
+ *
+ */
+bool
+memnesia_numa_sampler::available(void)
+{
+    return 0 == access("/proc/self/numa_maps", R_OK);
+}
+
+/**
+ * Each numa_maps line is a mapping's start address, its memory policy, and
+ * key=value fields, among them N<node>=<pages> and kernelpagesize_kB. Pages
+ * are counted as mapped by this process, not proportionally.
+ */
+bool
+memnesia_numa_sampler::get_usage(usage &u)
+{
+    (void)memset(&u, 0, sizeof(u));
+
+    FILE *numaf = fopen("/proc/self/numa_maps", "r");
+    if (!numaf) return false;
+
+    static const char trace_lib[] = "memnesia-trace.so";
+    static const size_t trace_lib_len = sizeof(trace_lib) - 1;
+
+    char lbuff[2 * PATH_MAX];
+    while (fgets(lbuff, sizeof(lbuff), numaf)) {
+        char *endp = nullptr;
+        const uintptr_t lo = uintptr_t(strtoull(lbuff, &endp, 16));
+        // The end of the mapping isn't given, so any page will do.
+        if (memnesia_arena::is_tool_mapping(lo, lo + 1)) continue;
+
+        int64_t pages[max_nodes];
+        int nnodes = 0;
+        int64_t page_kb = 4;
+        bool skip = false;
+        char *save = nullptr;
+        for (char *tok = strtok_r(endp, " \n", &save); tok;
+             tok = strtok_r(nullptr, " \n", &save)) {
+            if ('N' == tok[0] && isdigit(tok[1])) {
+                char *eq = nullptr;
+                const long node = strtol(tok + 1, &eq, 10);
+                if ('=' != *eq || node < 0 || node >= max_nodes) continue;
+                while (nnodes <= node) pages[nnodes++] = 0;
+                pages[node] += strtoll(eq + 1, nullptr, 10);
+            }
+            else if (0 == strncmp(tok, "kernelpagesize_kB=", 18)) {
+                page_kb = strtoll(tok + 18, nullptr, 10);
+            }
+            else if (0 == strncmp(tok, "file=", 5)) {
+                const size_t len = strlen(tok);
+                skip = len >= trace_lib_len &&
+                       0 == strcmp(tok + len - trace_lib_len, trace_lib);
+            }
+        }
+        if (skip) continue;
+        for (int n = 0; n < nnodes; ++n) {
+            u.node_in_kb[n] += pages[n] * page_kb;
+        }
+        u.nnodes = std::max(u.nnodes, nnodes);
+    }
+
+    fclose(numaf);
+
+    return true;
 }
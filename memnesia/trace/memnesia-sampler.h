@@ -8,11 +8,16 @@
 
 #pragma once
 
+#include "memnesia-arena.h"
+
 #include <inttypes.h>
 #include <string.h>
 
 #include <iostream>
 #include <map>
+#include <string>
+#include <utility>
+#include <vector>
 
 class memnesia_smaps_sampler {
 public:
@@ -36,8 +41,23 @@ public:
         KERNELPAGESIZE,
         MMUPAGESIZE,
         LOCKED,
+        // glibc heap (mallinfo2) entries.
+        HEAP_ARENA,
+        HEAP_INUSE,
+        HEAP_FREE,
+        HEAP_MMAPPED,
+        HEAP_KEEPCOST,
         LAST
     };
+    // Sources of samples (see MEMNESIA_SAMPLER).
+    enum backend_id {
+        SMAPS = 0,
+        SMAPS_ROLLUP,
+        STATM,
+        STATUS,
+        MALLINFO2,
+        BACKEND_LAST
+    };
     //
     static std::map<std::string, entry_id> tokid_tab;
     //
@@ -80,6 +100,8 @@ public:
     };
 
 private:
+    //
+    static backend_id backend;
     //
     static sample
     get_sample_impl(void);
@@ -91,4 +113,236 @@ public:
     {
         return get_sample_impl();
     }
+    // Selects a backend by name. Returns false if unknown or unavailable.
+    static bool
+    set_backend(const std::string &name);
+    //
+    static backend_id
+    get_backend(void)
+    {
+        return backend;
+    }
+    //
+    static const char *
+    get_backend_name(void);
+    // Bitmask of the entries the current backend fills.
+    static uint64_t
+    get_backend_fields(void);
+    // The entry used as memory usage.
+    static entry_id
+    get_usage_entry(void);
+};
+
+#define MEMNESIA_SAMPLER_FIELD(e) (uint64_t(1) << memnesia_smaps_sampler::e)
+
+/**
+ * Sampler backends, one specialization per source. Each declares the entries
+ * it fills and which of them stands for memory usage.
+ */
+template <memnesia_smaps_sampler::backend_id B>
+struct memnesia_sampler_backend;
+
+/**
+ * Per-mapping /proc/self/smaps, summed. The most detailed and the slowest.
+ */
+template <>
+struct memnesia_sampler_backend<memnesia_smaps_sampler::SMAPS> {
+    //
+    static constexpr uint64_t fields =
+        (MEMNESIA_SAMPLER_FIELD(LOCKED) << 1) - 1;
+    //
+    static constexpr memnesia_smaps_sampler::entry_id usage =
+        memnesia_smaps_sampler::PSS;
+    //
+    static const char *
+    name(void) { return "smaps"; }
+    //
+    static bool
+    sample(memnesia_smaps_sampler::sample &s);
+};
+
+/**
+ * /proc/self/smaps_rollup (Linux 4.14+): smaps totals computed by the kernel.
+ * The tool's own mappings (memnesia-trace.so, its arena) can't be left out.
+ */
+template <>
+struct memnesia_sampler_backend<memnesia_smaps_sampler::SMAPS_ROLLUP> {
+    //
+    static constexpr uint64_t fields =
+        memnesia_sampler_backend<memnesia_smaps_sampler::SMAPS>::fields &
+        ~(MEMNESIA_SAMPLER_FIELD(SIZE) |
+          MEMNESIA_SAMPLER_FIELD(KERNELPAGESIZE) |
+          MEMNESIA_SAMPLER_FIELD(MMUPAGESIZE));
+    //
+    static constexpr memnesia_smaps_sampler::entry_id usage =
+        memnesia_smaps_sampler::PSS;
+    //
+    static const char *
+    name(void) { return "smaps_rollup"; }
+    //
+    static bool
+    sample(memnesia_smaps_sampler::sample &s);
+};
+
+/**
+ * /proc/self/statm: virtual and resident size only, but very cheap.
+ */
+template <>
+struct memnesia_sampler_backend<memnesia_smaps_sampler::STATM> {
+    //
+    static constexpr uint64_t fields =
+        MEMNESIA_SAMPLER_FIELD(SIZE) | MEMNESIA_SAMPLER_FIELD(RSS);
+    //
+    static constexpr memnesia_smaps_sampler::entry_id usage =
+        memnesia_smaps_sampler::RSS;
+    //
+    static const char *
+    name(void) { return "statm"; }
+    //
+    static bool
+    sample(memnesia_smaps_sampler::sample &s);
+};
+
+/**
+ * /proc/self/status: resident size broken down a bit further than statm.
+ */
+template <>
+struct memnesia_sampler_backend<memnesia_smaps_sampler::STATUS> {
+    //
+    static constexpr uint64_t fields =
+        MEMNESIA_SAMPLER_FIELD(SIZE) |
+        MEMNESIA_SAMPLER_FIELD(RSS) |
+        MEMNESIA_SAMPLER_FIELD(ANONYMOUS) |
+        MEMNESIA_SAMPLER_FIELD(SWAP) |
+        MEMNESIA_SAMPLER_FIELD(LOCKED);
+    //
+    static constexpr memnesia_smaps_sampler::entry_id usage =
+        memnesia_smaps_sampler::RSS;
+    //
+    static const char *
+    name(void) { return "status"; }
+    //
+    static bool
+    sample(memnesia_smaps_sampler::sample &s);
+};
+
+/**
+ * glibc's mallinfo2(3): heap usage as seen by the allocator, with no system
+ * calls at all.
+ */
+template <>
+struct memnesia_sampler_backend<memnesia_smaps_sampler::MALLINFO2> {
+    //
+    static constexpr uint64_t fields =
+        MEMNESIA_SAMPLER_FIELD(HEAP_ARENA) |
+        MEMNESIA_SAMPLER_FIELD(HEAP_INUSE) |
+        MEMNESIA_SAMPLER_FIELD(HEAP_FREE) |
+        MEMNESIA_SAMPLER_FIELD(HEAP_MMAPPED) |
+        MEMNESIA_SAMPLER_FIELD(HEAP_KEEPCOST);
+    //
+    static constexpr memnesia_smaps_sampler::entry_id usage =
+        memnesia_smaps_sampler::HEAP_INUSE;
+    //
+    static const char *
+    name(void) { return "mallinfo2"; }
+    //
+    static bool
+    sample(memnesia_smaps_sampler::sample &s);
+};
+
+/**
+ * Cheap probe of the calling process' resident set size via /proc/self/statm.
+ */
+class memnesia_statm_sampler {
+public:
+    //
+    static bool
+    get_rss_in_kb(int64_t &rss_in_kb);
+};
+
+/**
+ * Per-mapping view of /proc/self/smaps. The tool's own mappings are left out,
+ * as they are by memnesia_smaps_sampler.
+ */
+class memnesia_mappings_sampler {
+public:
+    //
+    struct mapping {
+        // "start-end perms pathname", as in the smaps header.
+        memnesia_string name;
+        // Identifies the region across samples as it grows or shrinks:
+        // "dev:inode perms pathname" if file-backed, "perms pathname" if
+        // otherwise named (e.g., [heap], [stack]), else "start perms".
+        memnesia_string region;
+        // "dev:inode".
+        memnesia_string file;
+        //
+        uint64_t inode = 0;
+        // [start, end) and the file offset (bytes) mapped at start.
+        uintptr_t start = 0;
+        //
+        uintptr_t end = 0;
+        //
+        uint64_t offset = 0;
+        //
+        int64_t pss_in_kb = 0;
+        // Private_Clean + Private_Dirty.
+        int64_t private_in_kb = 0;
+        // Shared_Clean + Shared_Dirty.
+        int64_t shared_in_kb = 0;
+    };
+    //
+    static bool
+    get_mappings(memnesia_vector<mapping> &mappings);
+};
+
+/**
+ * Per-mapping view of /proc/self/smaps used for node-level footprints. Private
+ * pages belong to the calling process alone. Resident pages of file- or
+ * shmem-backed mappings that are also mapped elsewhere are listed by file and
+ * page index, read from /proc/self/pagemap, so that the processes on a node can
+ * count each of them exactly once.
+ */
+class memnesia_footprint_sampler {
+public:
+    // Runs of (first page index, number of pages) within a file.
+    typedef memnesia_vector< std::pair<uint64_t, uint64_t> > page_runs;
+    //
+    struct footprint {
+        //
+        int64_t pss_in_kb = 0;
+        // Private_Clean + Private_Dirty (USS).
+        int64_t private_in_kb = 0;
+        // Proportional share of shared anonymous pages (e.g., copy-on-write
+        // after fork), which cannot be matched across processes.
+        int64_t anon_shared_in_kb = 0;
+        // Shared file and shmem pages, keyed by "dev:inode".
+        memnesia_map<memnesia_string, page_runs> shared_pages;
+    };
+    //
+    static bool
+    get_footprint(footprint &fp);
+};
+
+/**
+ * Per-NUMA-node resident pages of the calling process via /proc/self/numa_maps,
+ * with the tool's own mappings left out.
+ */
+class memnesia_numa_sampler {
+public:
+    //
+    static constexpr int max_nodes = 64;
+    //
+    struct usage {
+        // Indexed by NUMA node.
+        int64_t node_in_kb[max_nodes];
+        // One past the highest node seen.
+        int nnodes;
+    };
+    //
+    static bool
+    available(void);
+    //
+    static bool
+    get_usage(usage &u);
 };
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-sampling.h"
+#include "memnesia-timer.h"
+#include "memnesia.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include <fnmatch.h>
+
+using namespace std;
+
+namespace {
+// How often (seconds) the adaptive controller revisits its stride.
+constexpr double adjust_period = 0.1;
+// Upper bound on the adaptive stride.
+constexpr int64_t max_stride = int64_t(1) << 20;
+}
+
+/**
+ * Parses a single policy. Format: always, every=N, interval=SECONDS, first=K.
+ */
+bool
+memnesia_sampling::parse_policy(
+    const std::string &spec,
+    policy &p
+) {
+    const size_t eq = spec.find('=');
+    const string name = spec.substr(0, eq);
+    const string value = (eq == string::npos) ? "" : spec.substr(eq + 1);
+
+    if (name == "always") {
+        p.id = ALWAYS;
+        return value.empty();
+    }
+    if (value.empty()) return false;
+
+    if (name == "every") {
+        p.id = EVERY_NTH;
+        p.n = atoll(value.c_str());
+        return p.n > 0;
+    }
+    if (name == "interval") {
+        p.id = MIN_INTERVAL;
+        p.interval = atof(value.c_str());
+        return p.interval >= 0.0;
+    }
+    if (name == "first") {
+        p.id = FIRST_K;
+        p.n = atoll(value.c_str());
+        return p.n >= 0;
+    }
+    return false;
+}
+
+/**
+ * Parses MEMNESIA_SAMPLING, a comma-separated list of PATTERN:POLICY pairs
+ * (e.g., "MPI_Send*:every=100,MPI_Alltoall:first=10,*:interval=0.01"), and
+ * MEMNESIA_OVERHEAD_BUDGET. The first pattern that matches a function's name
+ * sets its policy.
+ */
+void
+memnesia_sampling::init(double now)
+{
+    start_time = now;
+    last_adjust_time = now;
+
+    const char *budget = getenv(MEMNESIA_ENV_OVERHEAD_BUDGET);
+    if (budget) {
+        overhead_budget = atof(budget);
+        if (overhead_budget < 0.0) overhead_budget = 0.0;
+    }
+
+    const char *sampling = getenv(MEMNESIA_ENV_SAMPLING);
+    if (!sampling) return;
+
+    bool matched[MEMNESIA_FID_LAST] = {false};
+
+    stringstream ss(sampling);
+    string entry;
+    while (getline(ss, entry, ',')) {
+        if (entry.empty()) continue;
+
+        const size_t colon = entry.rfind(':');
+        policy p;
+        if (colon == string::npos ||
+            !parse_policy(entry.substr(colon + 1), p)) {
+            fprintf(
+                stderr,
+                "# memnesia: ignoring invalid sampling policy '%s'.\n",
+                entry.c_str()
+            );
+            continue;
+        }
+        const string pattern = entry.substr(0, colon);
+        for (int fid = 0; fid < MEMNESIA_FID_LAST; ++fid) {
+            if (matched[fid]) continue;
+            if (0 == fnmatch(pattern.c_str(), memnesia_func_names[fid], 0)) {
+                policies[fid] = p;
+                matched[fid] = true;
+            }
+        }
+    }
+}
+
+/**
+ * Sets the stride so that the expected sampling cost of the eligible call rate
+ * seen over the last period fits the budget. While the run's total overhead is
+ * over budget (e.g., after an expensive MPI_Init), the stride is scaled up
+ * further until the debt is paid off.
+ */
+void
+memnesia_sampling::adjust_stride(double now)
+{
+    const double window = now - last_adjust_time;
+    if (window < adjust_period) return;
+
+    if (window_sampled > 0) {
+        cost_per_call = window_tool_time / double(window_sampled);
+    }
+    const double eligible_rate = double(window_eligible) / window;
+
+    double target = eligible_rate * cost_per_call / overhead_budget;
+
+    const double overhead = tool_time / (now - start_time);
+    if (overhead > overhead_budget) {
+        target *= overhead / overhead_budget;
+    }
+
+    stride = int64_t(ceil(target));
+    if (stride < 1) stride = 1;
+    if (stride > max_stride) stride = max_stride;
+
+    last_adjust_time = now;
+    window_tool_time = 0.0;
+    window_eligible = 0;
+    window_sampled = 0;
+}
+
+/**
+ * Returns whether or not the current call of the given function should be
+ * sampled.
+ */
+bool
+memnesia_sampling::admit(
+    memnesia_func_id fid,
+    bool first_call
+) {
+    func_state &fs = states[fid];
+    const policy &p = policies[fid];
+
+    const int64_t call = fs.calls++;
+
+    bool sample = first_call;
+    double now = 0.0;
+    if (!sample) {
+        switch (p.id) {
+            case ALWAYS:
+                sample = true;
+                break;
+            case EVERY_NTH:
+                sample = (0 == call % p.n);
+                break;
+            case MIN_INTERVAL:
+                now = memnesia_time();
+                sample = (0 == fs.sampled) ||
+                         (now - fs.last_sample_time >= p.interval);
+                break;
+            case FIRST_K:
+                sample = (call < p.n);
+                break;
+        }
+        if (sample && budgeted()) {
+            if (0.0 == now) now = memnesia_time();
+            adjust_stride(now);
+            window_eligible++;
+            sample = (0 == eligible++ % stride);
+        }
+    }
+
+    if (!sample) {
+        fs.skipped++;
+        return false;
+    }
+
+    fs.sampled++;
+    window_sampled++;
+    if (MIN_INTERVAL == p.id) {
+        fs.last_sample_time = (0.0 == now) ? memnesia_time() : now;
+    }
+    return true;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include "memnesia-funcs.h"
+
+#include <inttypes.h>
+
+#include <string>
+
+/**
+ * Decides which MPI calls are sampled. Every call of a function may be
+ * sampled (the default), or only every Nth call, calls at least some time
+ * apart, or the first K calls. An optional adaptive controller further thins
+ * out sampling so that the time spent sampling stays under a fraction of wall
+ * time. First calls on a communicator are always sampled, since they are
+ * where one-time costs show up.
+ */
+class memnesia_sampling {
+public:
+    //
+    enum policy_id {
+        ALWAYS = 0,
+        EVERY_NTH,
+        MIN_INTERVAL,
+        FIRST_K
+    };
+    //
+    struct policy {
+        //
+        policy_id id = ALWAYS;
+        // For EVERY_NTH and FIRST_K.
+        int64_t n = 1;
+        // For MIN_INTERVAL (seconds).
+        double interval = 0.0;
+    };
+    //
+    struct func_state {
+        //
+        int64_t calls = 0;
+        //
+        int64_t sampled = 0;
+        //
+        int64_t skipped = 0;
+        //
+        double last_sample_time = 0.0;
+    };
+
+private:
+    //
+    policy policies[MEMNESIA_FID_LAST];
+    //
+    func_state states[MEMNESIA_FID_LAST];
+    // Fraction of wall time the tool may spend sampling. 0 means unlimited.
+    double overhead_budget = 0.0;
+    // Time the tool has spent sampling.
+    double tool_time = 0.0;
+    //
+    double start_time = 0.0;
+    // Adaptive stride: only one in stride otherwise eligible calls is sampled.
+    int64_t stride = 1;
+    // Number of eligible calls seen by the adaptive controller.
+    int64_t eligible = 0;
+    // Estimated tool time per sampled call.
+    double cost_per_call = 0.0;
+    //
+    double last_adjust_time = 0.0;
+    // Tool time, eligible calls, and sampled calls since the last adjustment.
+    double window_tool_time = 0.0;
+    //
+    int64_t window_eligible = 0;
+    //
+    int64_t window_sampled = 0;
+    //
+    static bool
+    parse_policy(
+        const std::string &spec,
+        policy &p
+    );
+    //
+    void
+    adjust_stride(double now);
+
+public:
+    //
+    memnesia_sampling(void) = default;
+    //
+    void
+    init(double now);
+    //
+    bool
+    admit(
+        memnesia_func_id fid,
+        bool first_call
+    );
+    //
+    void
+    add_tool_time(double seconds)
+    {
+        tool_time += seconds;
+        window_tool_time += seconds;
+    }
+    //
+    const func_state &
+    get_state(memnesia_func_id fid) const
+    {
+        return states[fid];
+    }
+    //
+    bool
+    budgeted(void) const
+    {
+        return overhead_budget > 0.0;
+    }
+    //
+    double
+    get_overhead_budget(void) const
+    {
+        return overhead_budget;
+    }
+    //
+    double
+    get_tool_time(void) const
+    {
+        return tool_time;
+    }
+    //
+    int64_t
+    get_stride(void) const
+    {
+        return stride;
+    }
+};
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-telemetry.h"
+#include "memnesia-arena.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+//
+void *
+map_segment(
+    const string &name,
+    int oflags,
+    size_t size
+) {
+    const int fd = shm_open(name.c_str(), oflags, 0644);
+    if (-1 == fd) {
+        perror("shm_open");
+        return nullptr;
+    }
+    if ((oflags & O_CREAT) && -1 == ftruncate(fd, off_t(size))) {
+        perror("ftruncate");
+        (void)::close(fd);
+        (void)shm_unlink(name.c_str());
+        return nullptr;
+    }
+    void *seg = mmap(
+        nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    (void)::close(fd);
+    if (MAP_FAILED == seg) {
+        perror("mmap");
+        return nullptr;
+    }
+    return seg;
+}
+} // namespace
+
+/**
+ * Creates and initializes the segment. Slots stay zeroed (i.e., unused) until
+ * their ranks attach.
+ */
+bool
+memnesia_telemetry::create(
+    const std::string &seg_name,
+    int32_t nslots,
+    int32_t world_size,
+    const char *hostname,
+    const char *app_name
+) {
+    const size_t size = memnesia_telemetry_size(nslots);
+    void *seg = map_segment(seg_name, O_CREAT | O_EXCL | O_RDWR, size);
+    if (!seg) return false;
+
+    auto *hdr = static_cast<memnesia_telemetry_header *>(seg);
+    hdr->nslots = nslots;
+    hdr->world_size = world_size;
+    (void)snprintf(hdr->hostname, sizeof(hdr->hostname), "%s", hostname);
+    (void)snprintf(hdr->app_name, sizeof(hdr->app_name), "%s", app_name);
+    hdr->version = MEMNESIA_TELEMETRY_VERSION;
+    // Readers check the magic last.
+    std::atomic_thread_fence(std::memory_order_release);
+    hdr->magic = MEMNESIA_TELEMETRY_MAGIC;
+
+    (void)munmap(seg, size);
+    name = seg_name;
+    owner = true;
+    return true;
+}
+
+/**
+ *
+ */
+bool
+memnesia_telemetry::attach(
+    const std::string &seg_name,
+    int32_t slot_index,
+    int32_t rank,
+    bool instrumented
+) {
+    // Just the header first, to learn the segment's size.
+    void *seg = map_segment(seg_name, O_RDWR, MEMNESIA_TELEMETRY_HEADER_SIZE);
+    if (!seg) return false;
+    const int32_t nslots = static_cast<memnesia_telemetry_header *>(
+        seg
+    )->nslots;
+    (void)munmap(seg, MEMNESIA_TELEMETRY_HEADER_SIZE);
+    if (slot_index < 0 || slot_index >= nslots) return false;
+
+    segment_size = memnesia_telemetry_size(nslots);
+    segment = map_segment(seg_name, O_RDWR, segment_size);
+    if (!segment) return false;
+    // Tool memory, not the application's.
+    memnesia_arena::exclude_range(segment, segment_size);
+
+    name = seg_name;
+    slot = &memnesia_telemetry_slots(segment)[slot_index];
+    record.rank = rank;
+    record.pid = int32_t(getpid());
+    record.instrumented = instrumented ? 1 : 0;
+    memnesia_telemetry_write(*slot, record);
+    return true;
+}
+
+/**
+ * Updates this rank's slot. A null func keeps the current function.
+ */
+void
+memnesia_telemetry::publish(
+    double time,
+    const char *func,
+    int64_t app_in_kb,
+    int64_t mpi_in_kb
+) {
+    if (!slot) return;
+
+    record.time = time;
+    if (func) {
+        (void)snprintf(record.func, sizeof(record.func), "%s", func);
+    }
+    if (app_in_kb >= 0) {
+        record.app_in_kb = app_in_kb;
+        if (app_in_kb > record.app_hwm_in_kb) {
+            record.app_hwm_in_kb = app_in_kb;
+        }
+        record.samples++;
+    }
+    record.mpi_in_kb = mpi_in_kb;
+    memnesia_telemetry_write(*slot, record);
+}
+
+/**
+ *
+ */
+void
+memnesia_telemetry::close(void)
+{
+    if (segment) {
+        memnesia_arena::forget_range(segment);
+        (void)munmap(segment, segment_size);
+        segment = nullptr;
+        slot = nullptr;
+    }
+    if (owner) {
+        (void)shm_unlink(name.c_str());
+        owner = false;
+    }
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * Layout of the node-local POSIX shared-memory segment through which memnesia
+ * publishes live per-rank memory usage (see memnesia-top). The node leader
+ * creates /dev/shm/memnesia.<leader pid>; each rank owns one slot and updates
+ * it under a seqlock, so readers never block writers.
+ */
+
+#pragma once
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+#define MEMNESIA_TELEMETRY_MAGIC   0x6d656d6eU
+#define MEMNESIA_TELEMETRY_VERSION 1
+#define MEMNESIA_TELEMETRY_PREFIX  "memnesia."
+// Bytes reserved for the header; slots follow it.
+#define MEMNESIA_TELEMETRY_HEADER_SIZE 512
+
+struct memnesia_telemetry_header {
+    //
+    uint32_t magic;
+    //
+    uint32_t version;
+    //
+    int32_t nslots;
+    //
+    int32_t world_size;
+    //
+    char hostname[64];
+    //
+    char app_name[192];
+};
+
+/**
+ * One slot per rank, each on its own cache line(s).
+ */
+struct alignas(64) memnesia_telemetry_slot {
+    // Odd while an update is in progress.
+    std::atomic<uint32_t> seq;
+    //
+    int32_t rank;
+    //
+    int32_t pid;
+    // Whether or not the rank is instrumented.
+    int32_t instrumented;
+    // Seconds since rank 0's MPI_Init, on rank 0's clock.
+    double time;
+    //
+    int64_t app_in_kb;
+    //
+    int64_t mpi_in_kb;
+    //
+    int64_t app_hwm_in_kb;
+    //
+    uint64_t samples;
+    // MPI function the rank is currently in, empty if none.
+    char func[32];
+};
+
+/**
+ * Plain copy of a slot's payload.
+ */
+struct memnesia_telemetry_record {
+    //
+    int32_t rank = -1;
+    //
+    int32_t pid = 0;
+    //
+    int32_t instrumented = 0;
+    //
+    double time = 0.0;
+    //
+    int64_t app_in_kb = 0;
+    //
+    int64_t mpi_in_kb = 0;
+    //
+    int64_t app_hwm_in_kb = 0;
+    //
+    uint64_t samples = 0;
+    //
+    char func[32] = {0};
+};
+
+/**
+ * Single writer update.
+ */
+static inline void
+memnesia_telemetry_write(
+    memnesia_telemetry_slot &slot,
+    const memnesia_telemetry_record &rec
+) {
+    const uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+    slot.seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.rank = rec.rank;
+    slot.pid = rec.pid;
+    slot.instrumented = rec.instrumented;
+    slot.time = rec.time;
+    slot.app_in_kb = rec.app_in_kb;
+    slot.mpi_in_kb = rec.mpi_in_kb;
+    slot.app_hwm_in_kb = rec.app_hwm_in_kb;
+    slot.samples = rec.samples;
+    (void)memcpy(slot.func, rec.func, sizeof(slot.func));
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.seq.store(seq + 2, std::memory_order_relaxed);
+}
+
+/**
+ * Returns false if the slot was being updated for the duration of the read.
+ */
+static inline bool
+memnesia_telemetry_read(
+    const memnesia_telemetry_slot &slot,
+    memnesia_telemetry_record &rec
+) {
+    for (int tries = 0; tries < 1024; ++tries) {
+        const uint32_t before = slot.seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        rec.rank = slot.rank;
+        rec.pid = slot.pid;
+        rec.instrumented = slot.instrumented;
+        rec.time = slot.time;
+        rec.app_in_kb = slot.app_in_kb;
+        rec.mpi_in_kb = slot.mpi_in_kb;
+        rec.app_hwm_in_kb = slot.app_hwm_in_kb;
+        rec.samples = slot.samples;
+        (void)memcpy(rec.func, slot.func, sizeof(rec.func));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (before == slot.seq.load(std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+/**
+ * Size of a segment with nslots slots.
+ */
+static inline size_t
+memnesia_telemetry_size(int32_t nslots)
+{
+    return MEMNESIA_TELEMETRY_HEADER_SIZE +
+           sizeof(memnesia_telemetry_slot) * size_t(nslots);
+}
+
+/**
+ *
+ */
+static inline memnesia_telemetry_slot *
+memnesia_telemetry_slots(void *segment)
+{
+    return reinterpret_cast<memnesia_telemetry_slot *>(
+        static_cast<char *>(segment) + MEMNESIA_TELEMETRY_HEADER_SIZE
+    );
+}
+
+static_assert(
+    sizeof(memnesia_telemetry_header) <= MEMNESIA_TELEMETRY_HEADER_SIZE,
+    "telemetry header too large"
+);
+
+/**
+ * A rank's view of the telemetry segment.
+ */
+class memnesia_telemetry {
+    //
+    void *segment = nullptr;
+    //
+    size_t segment_size = 0;
+    //
+    memnesia_telemetry_slot *slot = nullptr;
+    //
+    memnesia_telemetry_record record;
+    //
+    std::string name;
+    // Whether or not this rank created (and so removes) the segment.
+    bool owner = false;
+
+public:
+    //
+    bool
+    create(
+        const std::string &seg_name,
+        int32_t nslots,
+        int32_t world_size,
+        const char *hostname,
+        const char *app_name
+    );
+    //
+    bool
+    attach(
+        const std::string &seg_name,
+        int32_t slot_index,
+        int32_t rank,
+        bool instrumented
+    );
+    //
+    bool
+    enabled(void) const
+    {
+        return slot != nullptr;
+    }
+    //
+    void
+    publish(
+        double time,
+        const char *func,
+        int64_t app_in_kb,
+        int64_t mpi_in_kb
+    );
+    //
+    void
+    close(void);
+};
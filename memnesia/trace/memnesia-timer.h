@@ -10,3 +10,66 @@
 
 double
 memnesia_time(void);
+
+/**
+ * Maps this process' memnesia_time() onto rank 0's clock, given the offset
+ * between the two measured at ref_time and the drift rate between them, and
+ * expresses the result relative to an origin on rank 0's clock (MPI_Init).
+ */
+class memnesia_clock_map {
+    // Local time at which offset was measured.
+    double ref_time = 0.0;
+    // Local clock minus rank 0's clock at ref_time.
+    double offset = 0.0;
+    // Change in offset per second.
+    double drift = 0.0;
+    //
+    double origin = 0.0;
+
+public:
+    //
+    void
+    set_origin(double root_time)
+    {
+        origin = root_time;
+    }
+    //
+    void
+    set_offset(
+        double at_local_time,
+        double local_minus_root
+    ) {
+        ref_time = at_local_time;
+        offset = local_minus_root;
+    }
+    //
+    void
+    set_drift(double rate)
+    {
+        drift = rate;
+    }
+    //
+    double
+    get_ref_time(void) const
+    {
+        return ref_time;
+    }
+    //
+    double
+    get_offset(void) const
+    {
+        return offset;
+    }
+    //
+    double
+    get_drift(void) const
+    {
+        return drift;
+    }
+    // Seconds since the origin, on rank 0's clock.
+    double
+    since_origin(double local_time) const
+    {
+        return local_time - offset - drift * (local_time - ref_time) - origin;
+    }
+};
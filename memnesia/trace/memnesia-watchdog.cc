@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#include "memnesia-watchdog.h"
+#include "memnesia.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace {
+//
+int64_t
+limit_from_env(const char *name)
+{
+    const char *mb = getenv(name);
+    if (!mb) return -1;
+    const double val = atof(mb);
+    return val > 0.0 ? int64_t(val * 1024.0) : -1;
+}
+
+/**
+ * Memory in use on the node: MemTotal - MemAvailable.
+ */
+bool
+get_node_usage_in_kb(int64_t &usage_in_kb)
+{
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (!meminfo) return false;
+
+    long long total = -1, avail = -1, val = 0;
+    char lbuff[256], key[64];
+    while ((total < 0 || avail < 0) && fgets(lbuff, sizeof(lbuff), meminfo)) {
+        if (2 != sscanf(lbuff, "%63[^:]: %lld", key, &val)) continue;
+        if (0 == strcmp(key, "MemTotal")) total = val;
+        else if (0 == strcmp(key, "MemAvailable")) avail = val;
+    }
+    fclose(meminfo);
+    if (total < 0 || avail < 0) return false;
+
+    usage_in_kb = int64_t(total - avail);
+    return true;
+}
+} // namespace
+
+/**
+ * Thresholds are given in MB. MEMNESIA_WATCHDOG_ACTION is a comma-separated
+ * list of warn, flush, and abort. A warning is always logged.
+ */
+void
+memnesia_watchdog::init(void)
+{
+    limit_in_kb[APP] = limit_from_env(MEMNESIA_ENV_WATCHDOG_APP_MB);
+    limit_in_kb[MPI] = limit_from_env(MEMNESIA_ENV_WATCHDOG_MPI_MB);
+    limit_in_kb[NODE] = limit_from_env(MEMNESIA_ENV_WATCHDOG_NODE_MB);
+
+    const char *action_list = getenv(MEMNESIA_ENV_WATCHDOG_ACTION);
+    if (!action_list) return;
+
+    stringstream ss(action_list);
+    string act;
+    while (getline(ss, act, ',')) {
+        if (act == "warn") actions |= WARN;
+        else if (act == "flush") actions |= FLUSH;
+        else if (act == "abort") actions |= ABORT;
+        else {
+            fprintf(
+                stderr, "# memnesia: ignoring unknown %s action '%s'.\n",
+                MEMNESIA_ENV_WATCHDOG_ACTION, act.c_str()
+            );
+        }
+    }
+}
+
+/**
+ *
+ */
+const char *
+memnesia_watchdog::limit_name(limit_id lid)
+{
+    static const char *names[LAST] = {"APP", "MPI", "NODE"};
+    return names[lid];
+}
+
+/**
+ *
+ */
+void
+memnesia_watchdog::set_baseline(void)
+{
+    started = true;
+
+    memnesia_vector<memnesia_mappings_sampler::mapping> mappings;
+    if (!memnesia_mappings_sampler::get_mappings(mappings)) return;
+
+    baseline.clear();
+    for (const auto &m : mappings) {
+        baseline[m.region] += m.pss_in_kb;
+    }
+}
+
+/**
+ *
+ */
+memnesia_watchdog::limit_id
+memnesia_watchdog::check(
+    int64_t app_in_kb,
+    int64_t mpi_in_kb,
+    double now,
+    int64_t &usage_in_kb
+) {
+    if (!fired[APP] && limit_in_kb[APP] >= 0 &&
+        app_in_kb > limit_in_kb[APP]) {
+        fired[APP] = true;
+        usage_in_kb = app_in_kb;
+        return APP;
+    }
+    if (!fired[MPI] && limit_in_kb[MPI] >= 0 &&
+        mpi_in_kb > limit_in_kb[MPI]) {
+        fired[MPI] = true;
+        usage_in_kb = mpi_in_kb;
+        return MPI;
+    }
+    if (!fired[NODE] && limit_in_kb[NODE] >= 0 &&
+        now - last_node_check >= node_check_interval) {
+        last_node_check = now;
+        int64_t node_in_kb = 0;
+        if (get_node_usage_in_kb(node_in_kb) &&
+            node_in_kb > limit_in_kb[NODE]) {
+            fired[NODE] = true;
+            usage_in_kb = node_in_kb;
+            return NODE;
+        }
+    }
+    return LAST;
+}
+
+/**
+ * Returns the n mappings whose PSS grew the most since the baseline, one per
+ * line, formatted as "+GROWTH_MB NAME". Mappings are matched by region, not
+ * by name, since a growing mapping's address range changes. Called while the
+ * application runs, so everything is allocated from the tool's arena.
+ */
+memnesia_string
+memnesia_watchdog::top_growing_mappings(size_t n)
+{
+    memnesia_vector<memnesia_mappings_sampler::mapping> mappings;
+    if (!memnesia_mappings_sampler::get_mappings(mappings)) return "";
+
+    typedef pair<int64_t, memnesia_string> pss_and_name;
+    // Region to PSS and the current name of (one of) its mappings.
+    memnesia_map<memnesia_string, pss_and_name> now;
+    for (const auto &m : mappings) {
+        auto &r = now[m.region];
+        r.first += m.pss_in_kb;
+        if (r.second.empty()) r.second = m.name;
+    }
+    memnesia_vector<pss_and_name> growth;
+    for (const auto &r : now) {
+        const auto got = baseline.find(r.first);
+        const int64_t before = (got == baseline.end()) ? 0 : got->second;
+        if (r.second.first > before) {
+            growth.push_back(
+                make_pair(r.second.first - before, r.second.second)
+            );
+        }
+    }
+    const size_t top = min(n, growth.size());
+    partial_sort(
+        growth.begin(), growth.begin() + top, growth.end(),
+        [](const pss_and_name &a, const pss_and_name &b) {
+            return a.first > b.first;
+        }
+    );
+
+    memnesia_stringstream ss;
+    for (size_t i = 0; i < top; ++i) {
+        ss << "+" << memnesia_util_kb2mb(growth[i].first) << " MB "
+           << growth[i].second << "\n";
+    }
+    return ss.str();
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+#pragma once
+
+#include "memnesia-arena.h"
+#include "memnesia-sampler.h"
+
+#include <inttypes.h>
+
+#include <map>
+#include <string>
+
+/**
+ * Memory budget watchdog. Checks sampled usage against per-rank (APP, MPI) and
+ * per-node thresholds so that something is known about a run before the OOM
+ * killer ends it. Each threshold fires at most once.
+ */
+class memnesia_watchdog {
+public:
+    //
+    enum limit_id {
+        APP = 0,
+        MPI,
+        NODE,
+        LAST
+    };
+    //
+    enum action {
+        WARN  = 1 << 0,
+        FLUSH = 1 << 1,
+        ABORT = 1 << 2
+    };
+
+private:
+    // Negative means no limit.
+    int64_t limit_in_kb[LAST] = {-1, -1, -1};
+    //
+    bool fired[LAST] = {false, false, false};
+    //
+    int actions = WARN;
+    // Node usage is read from /proc/meminfo at most this often (s).
+    static constexpr double node_check_interval = 0.1;
+    //
+    double last_node_check = 0.0;
+    // PSS by region (see memnesia_mappings_sampler) when the baseline was
+    // taken.
+    memnesia_map<memnesia_string, int64_t> baseline;
+    // Checks start once the baseline is taken.
+    bool started = false;
+
+public:
+    //
+    void
+    init(void);
+    //
+    bool
+    armed(void) const
+    {
+        return limit_in_kb[APP] >= 0 ||
+               limit_in_kb[MPI] >= 0 ||
+               limit_in_kb[NODE] >= 0;
+    }
+    //
+    bool
+    is_started(void) const
+    {
+        return started;
+    }
+    //
+    int
+    get_actions(void) const
+    {
+        return actions;
+    }
+    //
+    int64_t
+    get_limit_in_kb(limit_id lid) const
+    {
+        return limit_in_kb[lid];
+    }
+    //
+    static const char *
+    limit_name(limit_id lid);
+    //
+    void
+    set_baseline(void);
+    /**
+     * Returns the limit crossed for the first time by the given usage, if any.
+     * Sets usage_in_kb to the offending value.
+     */
+    limit_id
+    check(
+        int64_t app_in_kb,
+        int64_t mpi_in_kb,
+        double now,
+        int64_t &usage_in_kb
+    );
+    //
+    memnesia_string
+    top_growing_mappings(size_t n);
+};
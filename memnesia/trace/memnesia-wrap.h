@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2017-2021 Triad National Security, LLC
+ *                         All rights reserved.
+ *
+ * This file is part of the mpimemu project. See the LICENSE file at the
+ * top-level directory of this distribution.
+ */
+
+/**
+ * The body shared by the MPI wrappers. A wrapper is
+ *
+ *     return MEMNESIA_WRAP(MPI_Send)::call(buf, count, ..., comm);
+ *
+ * which is resolved at compile time from the function's identifier and its
+ * PMPI entry point. How a function is instrumented is its policy (see
+ * memnesia_func_policy), and what the caliper learns from its arguments
+ * comes from its traits (see memnesia_func_traits). Both are specialized
+ * below; everything else gets the defaults.
+ */
+
+#pragma once
+
+#include "memnesia-rt.h"
+#include "memnesia-funcs.h"
+
+#include <tuple>
+#include <type_traits>
+
+#include "mpi.h"
+
+/**
+ * Tail calls PMPI, with no caliper and no runtime check. For functions that
+ * are not worth instrumenting in any run.
+ */
+struct memnesia_passthrough_policy {
+    //
+    template <memnesia_func_id FID, typename Fn, Fn PMPI, typename... Args>
+    static int
+    call(Args... args)
+    {
+        return PMPI(args...);
+    }
+};
+
+/**
+ * Brackets the call with a caliper, unless MEMNESIA_FUNCS left the function
+ * out.
+ */
+struct memnesia_caliper_policy {
+    //
+    template <memnesia_func_id FID, typename Fn, Fn PMPI, typename... Args>
+    static int
+    call(Args... args);
+};
+
+/**
+ * A function's policy. The default is memnesia_caliper_policy.
+ */
+template <memnesia_func_id FID>
+struct memnesia_func_policy {
+    //
+    typedef memnesia_caliper_policy type;
+};
+
+/**
+ * What the caliper takes from a function's arguments. Positions are -1 when
+ * the function has no such argument.
+ */
+template <memnesia_func_id FID>
+struct memnesia_func_traits {
+    // Position of the communicator argument (for first-contact tracking).
+    static constexpr int comm_arg = -1;
+    // Positions of the count and datatype arguments of the message sent (or
+    // received), for its size in bytes.
+    static constexpr int count_arg = -1;
+    static constexpr int type_arg = -1;
+    // Position of the peer (destination, source, or root) rank argument.
+    static constexpr int peer_arg = -1;
+};
+
+/**
+ * Extracts argument I, which must be a T, or none if I is negative.
+ */
+template <int I, typename T>
+struct memnesia_arg {
+    //
+    template <typename... Args>
+    static T
+    get(T, Args... args)
+    {
+        static_assert(
+            std::is_same<
+                typename std::tuple_element<I, std::tuple<Args...>>::type,
+                T
+            >::value,
+            "memnesia_func_traits names an argument of the wrong type"
+        );
+        return std::get<I>(std::forward_as_tuple(args...));
+    }
+};
+
+template <typename T>
+struct memnesia_arg<-1, T> {
+    //
+    template <typename... Args>
+    static T
+    get(T none, Args...)
+    {
+        return none;
+    }
+};
+
+template <memnesia_func_id FID, typename Fn, Fn PMPI, typename... Args>
+inline int
+memnesia_caliper_policy::call(Args... args)
+{
+    if (!memnesia_func_instrumented(FID)) return PMPI(args...);
+    //
+    int rc = MPI_ERR_UNKNOWN;
+    {
+        typedef memnesia_func_traits<FID> traits;
+        memnesia_scoped_caliper caliper(
+            FID,
+            memnesia_arg<traits::comm_arg, MPI_Comm>::get(
+                MPI_COMM_NULL, args...
+            ),
+            memnesia_arg<traits::count_arg, int>::get(0, args...),
+            memnesia_arg<traits::type_arg, MPI_Datatype>::get(
+                MPI_DATATYPE_NULL, args...
+            ),
+            memnesia_arg<traits::peer_arg, int>::get(-1, args...)
+        );
+        rc = PMPI(args...);
+    }
+    //
+    return rc;
+}
+
+/**
+ * The wrapper of the function identified by FID, whose PMPI entry point is
+ * PMPI. The entry point is a template argument, so calls to it are direct.
+ */
+template <memnesia_func_id FID, typename Fn, Fn PMPI>
+struct memnesia_wrapper;
+
+template <
+    memnesia_func_id FID,
+    typename... Params,
+    int (*PMPI)(Params...)
+>
+struct memnesia_wrapper<FID, int (*)(Params...), PMPI> {
+    //
+    static int
+    call(Params... args)
+    {
+        return memnesia_func_policy<FID>::type::template call<
+            FID, int (*)(Params...), PMPI
+        >(args...);
+    }
+};
+
+#define MEMNESIA_WRAP(name)                                                    \
+    memnesia_wrapper<MEMNESIA_FID(name), decltype(&P##name), &P##name>
+
+// For example, MEMNESIA_FUNC_POLICY(MPI_Address, memnesia_passthrough_policy);
+#define MEMNESIA_FUNC_POLICY(name, policy)                                     \
+template <>                                                                    \
+struct memnesia_func_policy<MEMNESIA_FID(name)> {                              \
+    typedef policy type;                                                       \
+}
+
+//
+#define MEMNESIA_FUNC_TRAITS(name, comm, count, type, peer)                    \
+template <>                                                                    \
+struct memnesia_func_traits<MEMNESIA_FID(name)> {                              \
+    static constexpr int comm_arg = comm;                                      \
+    static constexpr int count_arg = count;                                    \
+    static constexpr int type_arg = type;                                      \
+    static constexpr int peer_arg = peer;                                      \
+}
+
+//                   name                comm count type peer
+MEMNESIA_FUNC_TRAITS(MPI_Irecv,          5,   1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Send,           5,   1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Recv,           5,   1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Isend,          5,   1,    2,   3);
+// The send side.
+MEMNESIA_FUNC_TRAITS(MPI_Sendrecv,       10,  1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Iprobe,         2,   -1,   -1,  0);
+MEMNESIA_FUNC_TRAITS(MPI_Issend,         5,   1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Ssend,          5,   1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Comm_size,      0,   -1,   -1,  -1);
+MEMNESIA_FUNC_TRAITS(MPI_Comm_rank,      0,   -1,   -1,  -1);
+MEMNESIA_FUNC_TRAITS(MPI_Barrier,        0,   -1,   -1,  -1);
+MEMNESIA_FUNC_TRAITS(MPI_Allreduce,      5,   2,    3,   -1);
+MEMNESIA_FUNC_TRAITS(MPI_Bcast,          4,   1,    2,   3);
+MEMNESIA_FUNC_TRAITS(MPI_Reduce,         6,   2,    3,   5);
+// Per peer.
+MEMNESIA_FUNC_TRAITS(MPI_Alltoall,       6,   1,    2,   -1);
+MEMNESIA_FUNC_TRAITS(MPI_Comm_split,     0,   -1,   -1,  -1);
+
+// Functions left out at build time (MEMNESIA_PASSTHROUGH_FUNCS).
+#include "memnesia-passthrough.h"
@@ -10,10 +10,45 @@
 
 #include <cstdlib>
 
-#define MEMNESIA_FUNC __func__
+#define MEMNESIA_MARK_FUNC "memnesia_mark"
+
+// MPI_Pcontrol levels.
+#define MEMNESIA_PCONTROL_OFF  0
+#define MEMNESIA_PCONTROL_ON   1
+#define MEMNESIA_PCONTROL_MARK 2
 
 #define MEMNESIA_ENV_REPORT_OUTPUT_PATH "MEMNESIA_REPORT_OUTPUT_PATH"
 #define MEMNESIA_ENV_REPORT_NAME        "MEMNESIA_REPORT_NAME"
+#define MEMNESIA_ENV_CALLSTACK_DEPTH    "MEMNESIA_CALLSTACK_DEPTH"
+#define MEMNESIA_ENV_REPORT_FORMATS     "MEMNESIA_REPORT_FORMATS"
+#define MEMNESIA_ENV_START_ENABLED      "MEMNESIA_START_ENABLED"
+#define MEMNESIA_ENV_FUNCS              "MEMNESIA_FUNCS"
+#define MEMNESIA_ENV_SAMPLING           "MEMNESIA_SAMPLING"
+#define MEMNESIA_ENV_OVERHEAD_BUDGET    "MEMNESIA_OVERHEAD_BUDGET"
+#define MEMNESIA_ENV_STATM_GATE         "MEMNESIA_STATM_GATE"
+#define MEMNESIA_ENV_SHARE_GAP          "MEMNESIA_SHARE_GAP"
+#define MEMNESIA_ENV_RANKS              "MEMNESIA_RANKS"
+#define MEMNESIA_ENV_NODE_GRID          "MEMNESIA_NODE_GRID"
+#define MEMNESIA_ENV_TELEMETRY          "MEMNESIA_TELEMETRY"
+#define MEMNESIA_ENV_WATCHDOG_APP_MB    "MEMNESIA_WATCHDOG_APP_MB"
+#define MEMNESIA_ENV_WATCHDOG_MPI_MB    "MEMNESIA_WATCHDOG_MPI_MB"
+#define MEMNESIA_ENV_WATCHDOG_NODE_MB   "MEMNESIA_WATCHDOG_NODE_MB"
+#define MEMNESIA_ENV_WATCHDOG_ACTION    "MEMNESIA_WATCHDOG_ACTION"
+#define MEMNESIA_ENV_LOG_RECORDS        "MEMNESIA_LOG_RECORDS"
+#define MEMNESIA_ENV_SNAPSHOT_DIR       "MEMNESIA_SNAPSHOT_DIR"
+#define MEMNESIA_ENV_CLOCK_SYNC         "MEMNESIA_CLOCK_SYNC"
+#define MEMNESIA_ENV_SAMPLER            "MEMNESIA_SAMPLER"
+#define MEMNESIA_ENV_ARENA_MB           "MEMNESIA_ARENA_MB"
+#define MEMNESIA_ENV_NUMA               "MEMNESIA_NUMA"
+#define MEMNESIA_ENV_HEAP               "MEMNESIA_HEAP"
+#define MEMNESIA_ENV_FAULTS             "MEMNESIA_FAULTS"
+#define MEMNESIA_ENV_FAULT_GATE         "MEMNESIA_FAULT_GATE"
+#define MEMNESIA_ENV_HEAT_BUCKETS       "MEMNESIA_HEAT_BUCKETS"
+
+#define MEMNESIA_REPORT_FORMAT_MEMNESIA "memnesia"
+#define MEMNESIA_REPORT_FORMAT_PPROF    "pprof"
+#define MEMNESIA_REPORT_FORMAT_FOLDED   "folded"
+#define MEMNESIA_REPORT_FORMAT_CHROME   "chrome"
 
 template<typename T>
 static inline double